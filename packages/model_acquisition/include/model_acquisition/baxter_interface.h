@@ -21,18 +21,37 @@
 
 #include <baxter_traj_streamer/trajAction.h>
 
+#include <boost/scoped_ptr.hpp>
+
 #define VECTOR_DIM 7  // e.g., a 7-dof vector
 
 class BaxterInterface : public AbstractRobot
 {
 public:
+  // Connects to trajActionServer and waits for the first joint state, up to
+  // model_acquisition/traj_server_timeout seconds each
   BaxterInterface(ros::NodeHandle &nh);
   virtual ~BaxterInterface();
 
+  // Whether the trajectory server was found and a joint state has arrived.
+  // goToPose tries to connect again when it is not.
+  bool isReady();
+
 private:
+  typedef actionlib::SimpleActionClient<baxter_traj_streamer::trajAction> TrajActionClient;
+
   ros::NodeHandle nh_;
   // Vectorq7x1 scan_pose;
 
+  // Created once, their subscriptions and connections stay up between poses
+  boost::scoped_ptr<Baxter_traj_streamer> traj_streamer_;
+  boost::scoped_ptr<TrajActionClient> action_client_;
+  ros::Duration server_timeout_;
+  uint traj_count_;
+  bool have_joint_state_;
+
+  bool waitUntilReady(const ros::Duration &timeout);
+
   virtual void updateLeftJointAngles(const sensor_msgs::JointState& jointstate);
 
   virtual void doneCb(const actionlib::SimpleClientGoalState& state,
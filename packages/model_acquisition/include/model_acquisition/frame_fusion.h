@@ -0,0 +1,48 @@
+/*
+ * frame_fusion
+ *
+ * Copyright (c) 2015, Luc Bettaieb
+ * BSD Licensed
+ *
+ */
+
+#ifndef FRAME_FUSION_H
+#define FRAME_FUSION_H
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include <string>
+#include <vector>
+
+// How the frames taken at one angle are combined into a single cloud.
+enum FusionMode
+{
+  FUSION_NONE = 0,    // every frame is written on its own
+  FUSION_MEDIAN = 1,  // per pixel, the sample with the median depth
+  FUSION_MEAN = 2     // per pixel, the mean of the samples close to the median depth
+};
+
+// Maps the settings.yaml spelling ("none", "median", "mean") onto a FusionMode.
+// Returns false and leaves mode untouched for unknown names.
+bool parseFusionMode(const std::string &name, FusionMode &mode);
+
+struct FusionParams
+{
+  FusionMode mode;
+  // Samples further than this fraction of the median depth from it are
+  // outliers.  A pixel needs inliers in more than half the frames.
+  double max_deviation;
+  // A fused pixel whose depth jumps by more than this fraction from both of
+  // its horizontal or both of its vertical neighbours is a flying pixel,
+  // smeared between a foreground edge and the background, and is dropped.
+  double flying_threshold;
+};
+
+// Fuses organized frames of the same size pixel by pixel into fused.  Rejected
+// pixels are NaN, so fused keeps the frames' width and height.  Returns false,
+// leaving fused untouched, for unorganized frames or frames of different sizes.
+bool fuseFrames(const std::vector<pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr> &frames,
+                const FusionParams &params, pcl::PointCloud<pcl::PointXYZRGB> &fused);
+
+#endif  // FRAME_FUSION_H
@@ -29,7 +29,14 @@
 #include <pcl/filters/extract_indices.h>
 #include <pcl-1.7/pcl/impl/point_types.hpp>
 
+#include "model_acquisition/pcd_format.h"
+#include "model_acquisition/snapshot_writer.h"
+
+#include <boost/scoped_ptr.hpp>
+
+#include <deque>
 #include <string>
+#include <vector>
 
 class Kinect2Interface
 {
@@ -37,12 +44,47 @@ public:
   Kinect2Interface(ros::NodeHandle &nh);
   virtual ~Kinect2Interface();
 
+  // Queues the most recent frame for writing
   void snapshot(std::string obj_name, uint snapshot_num, double snapshot_angle);
+  bool snapshot(const sensor_msgs::PointCloud2ConstPtr &frame, std::string obj_name, uint snapshot_num,
+                double snapshot_angle);
+  // Queues the frames to be fused into a single snapshot
+  bool snapshot(const std::vector<sensor_msgs::PointCloud2ConstPtr> &frames, std::string obj_name,
+                uint snapshot_num, double snapshot_angle);
+
+  // Whether the snapshots taken at one angle should be fused into one
+  bool fusesFrames() const;
+
+  // Waits until every queued snapshot is written, returns how many failed
+  size_t flush();
+
+  // Oldest buffered frame stamped after stamp, spinning until one arrives or
+  // timeout passes.  Returns an empty pointer on timeout.
+  sensor_msgs::PointCloud2ConstPtr getFrameAfter(const ros::Time &stamp, const ros::Duration &timeout);
+  sensor_msgs::PointCloud2ConstPtr getFrameAfter(const ros::Time &stamp);
+
+  // Stamp a frame is ordered by: its header stamp, or the time it arrived
+  // for publishers that leave the stamp empty
+  ros::Time frameStamp(const sensor_msgs::PointCloud2ConstPtr &frame) const;
 
 private:
   ros::NodeHandle nh_;
 
-  pcl::PointCloud<pcl::PointXYZRGB>::Ptr p_pclKinect;
+  struct StampedFrame
+  {
+    ros::Time stamp;
+    sensor_msgs::PointCloud2ConstPtr cloud;
+  };
+
+  // Last frame_buffer_size messages from the scan topic, oldest first.
+  // They are only converted when a snapshot is taken.
+  std::deque<StampedFrame> frames_;
+  size_t frame_buffer_size_;
+  ros::Duration frame_timeout_;
+
+  PcdFormat pcd_format_;
+  FusionParams fusion_;
+  boost::scoped_ptr<SnapshotWriter> writer_;
 
   void kinectCB(const sensor_msgs::PointCloud2ConstPtr &cloud);
 };
@@ -0,0 +1,90 @@
+/*
+ * pcd_format
+ *
+ * Copyright (c) 2015, Luc Bettaieb
+ * BSD Licensed
+ *
+ */
+
+#ifndef PCD_FORMAT_H
+#define PCD_FORMAT_H
+
+#include <pcl/io/pcd_io.h>
+#include <pcl/point_cloud.h>
+#include <pcl/PCLPointCloud2.h>
+
+#include <string>
+
+// On-disk encodings supported for snapshot PCDs.
+enum PcdFormat
+{
+  PCD_ASCII = 0,
+  PCD_BINARY = 1,
+  PCD_BINARY_COMPRESSED = 2
+};
+
+// Maps the settings.yaml spelling of a format ("ascii", "binary", "binary_compressed")
+// onto a PcdFormat.  Returns false and leaves format untouched for unknown names.
+inline bool parsePcdFormat(const std::string &name, PcdFormat &format)
+{
+  if (name == "ascii")
+    format = PCD_ASCII;
+  else if (name == "binary")
+    format = PCD_BINARY;
+  else if (name == "binary_compressed")
+    format = PCD_BINARY_COMPRESSED;
+  else
+    return false;
+
+  return true;
+}
+
+inline const char* pcdFormatName(PcdFormat format)
+{
+  switch (format)
+  {
+    case PCD_BINARY:
+      return "binary";
+    case PCD_BINARY_COMPRESSED:
+      return "binary_compressed";
+    default:
+      return "ascii";
+  }
+}
+
+// Writes cloud to file_name in the requested encoding.  The binary writers copy the
+// point fields straight out of cloud.points, so no text formatting happens for them.
+template <typename PointT>
+inline int writePcd(const std::string &file_name, const pcl::PointCloud<PointT> &cloud, PcdFormat format)
+{
+  pcl::PCDWriter writer;
+
+  switch (format)
+  {
+    case PCD_BINARY:
+      return writer.writeBinary(file_name, cloud);
+    case PCD_BINARY_COMPRESSED:
+      return writer.writeBinaryCompressed(file_name, cloud);
+    default:
+      return writer.writeASCII(file_name, cloud);
+  }
+}
+
+// Same for a cloud still in its message layout.  The fields and padding of cloud.data
+// are written as they are, without converting to a point type first.
+inline int writePcd(const std::string &file_name, const pcl::PCLPointCloud2 &cloud, PcdFormat format)
+{
+  pcl::PCDWriter writer;
+
+  switch (format)
+  {
+    case PCD_BINARY:
+      return writer.writeBinary(file_name, cloud);
+    case PCD_BINARY_COMPRESSED:
+      return writer.writeBinaryCompressed(file_name, cloud);
+    default:
+      return writer.writeASCII(file_name, cloud);
+  }
+}
+
+#endif  // PCD_FORMAT_H
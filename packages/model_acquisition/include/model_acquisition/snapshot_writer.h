@@ -0,0 +1,68 @@
+/*
+ * snapshot_writer
+ *
+ * Copyright (c) 2015, Luc Bettaieb
+ * BSD Licensed
+ *
+ */
+
+#ifndef SNAPSHOT_WRITER_H
+#define SNAPSHOT_WRITER_H
+
+#include <sensor_msgs/PointCloud2.h>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "model_acquisition/frame_fusion.h"
+#include "model_acquisition/pcd_format.h"
+
+#include <deque>
+#include <string>
+#include <vector>
+
+// Writes snapshots on a background thread so the arm can move on while the
+// previous frames are serialized.  Frames are handed over as the subscriber's
+// shared message, nothing is copied until the writer converts it.  At most
+// max_pending snapshots wait at a time, write blocks while the queue is full.
+class SnapshotWriter
+{
+public:
+  SnapshotWriter(PcdFormat format, size_t max_pending, const FusionParams &fusion);
+  virtual ~SnapshotWriter();
+
+  void write(const std::string &file_name, const sensor_msgs::PointCloud2ConstPtr &frame);
+  // Fuses the frames into one cloud on the writer thread and writes that
+  void write(const std::string &file_name, const std::vector<sensor_msgs::PointCloud2ConstPtr> &frames);
+
+  // Waits until every queued snapshot is on disk.  Returns the number of
+  // snapshots that failed to write since the last flush.
+  size_t flush();
+
+private:
+  struct Job
+  {
+    std::string file_name;
+    std::vector<sensor_msgs::PointCloud2ConstPtr> frames;
+  };
+
+  void writeLoop();
+  bool writeJob(const Job &job);
+
+  PcdFormat format_;
+  FusionParams fusion_;
+  size_t max_pending_;
+
+  // mutex_ guards everything below
+  std::deque<Job> jobs_;
+  bool busy_;
+  bool stopping_;
+  size_t failed_;
+  boost::mutex mutex_;
+  boost::condition_variable changed_;
+
+  boost::thread thread_;
+};
+
+#endif  // SNAPSHOT_WRITER_H
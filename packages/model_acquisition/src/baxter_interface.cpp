@@ -17,6 +17,7 @@ baxter_core_msgs::JointCommand left_cmd;
 double leftJointAngles [7];
 
 BaxterInterface::BaxterInterface(ros::NodeHandle &nh)
+  : traj_count_(0), have_joint_state_(false)
 {
   // load in increment angle from parameter server
   // make sure its divisible by 360, if not, set to closest angle that is divisible by 360
@@ -35,6 +36,18 @@ BaxterInterface::BaxterInterface(ros::NodeHandle &nh)
 
   g_LeftJointPublisher = nh_.advertise<baxter_core_msgs::JointCommand>("/robot/limb/left/joint_command", 1);
   g_LeftJointListener = nh_.subscribe("/robot/joint_states", 3, &BaxterInterface::updateLeftJointAngles, this);
+
+  double server_timeout;
+  if (!nh_.getParam("model_acquisition/traj_server_timeout", server_timeout))
+    server_timeout = 5.0;  // Default behavior
+  server_timeout_ = ros::Duration(server_timeout);
+
+  ROS_DEBUG("Instantiating a traj streamer");
+  traj_streamer_.reset(new Baxter_traj_streamer(&nh_));
+  action_client_.reset(new TrajActionClient("trajActionServer", true));
+
+  if (!waitUntilReady(server_timeout_))
+    ROS_WARN("trajActionServer or joint states not available yet, will retry on the first pose");
 }
 
 BaxterInterface::~BaxterInterface()
@@ -48,6 +61,33 @@ void BaxterInterface::doneCb(const actionlib::SimpleClientGoalState& state,
   ROS_INFO("got return val = %d; traj_id = %d", result->return_val, result->traj_id);
 }
 
+bool BaxterInterface::isReady()
+{
+  return have_joint_state_ && action_client_->isServerConnected();
+}
+
+bool BaxterInterface::waitUntilReady(const ros::Duration &timeout)
+{
+  ros::Time deadline = ros::Time::now() + timeout;
+
+  // Replaces the fixed warm up: spin only until the first joint state is in
+  while (!have_joint_state_ && ros::ok() && ros::Time::now() < deadline)
+  {
+    ros::spinOnce();
+    ros::Duration(0.01).sleep();
+  }
+
+  if (!have_joint_state_)
+    return false;
+
+  ros::Duration remaining = deadline - ros::Time::now();
+  if (action_client_->isServerConnected())
+    return true;
+
+  ROS_DEBUG("Waiting for server: ");
+  return remaining > ros::Duration(0) && action_client_->waitForServer(remaining);
+}
+
 Vectorq7x1 BaxterInterface::getLeftArmPose()
 {
   ros::spinOnce();
@@ -72,6 +112,7 @@ void BaxterInterface::updateLeftJointAngles(const sensor_msgs::JointState& joint
   {
     leftJointAngles[i] = jointstate.position.at(i+2);
   }
+  have_joint_state_ = true;
 }
 
 bool BaxterInterface::setJointToAngle(int joint, double angle)
@@ -87,8 +128,6 @@ bool BaxterInterface::setJointToAngle(int joint, double angle)
 
 bool BaxterInterface::goToPose(Vectorq7x1 pose, int lr)
 {
-  uint g_count = 0;
-  uint ans;
   Eigen::VectorXd q_in_vecxd;
 
   Vectorq7x1 q_vec_left_arm;
@@ -98,14 +137,16 @@ bool BaxterInterface::goToPose(Vectorq7x1 pose, int lr)
 
   trajectory_msgs::JointTrajectory des_trajectory;
 
-  ROS_DEBUG("Instantiating a traj streamer");
-  Baxter_traj_streamer ts(&nh_);
+  if (lr != 1 && lr != 0)
+  {
+    ROS_WARN("left or right arm not selected.  halting.");
+    return false;
+  }
 
-  ROS_DEBUG("Warming up callbacks");  // Is this necessary?  Test with and without it.
-  for (uint i = 0; i < 100; i++)
+  if (!isReady() && !waitUntilReady(server_timeout_))
   {
-    ros::spinOnce();
-    ros::Duration(0.01).sleep();
+    ROS_WARN("Could not connect to server.");
+    return false;
   }
 
   ROS_DEBUG("Getting current pose.");
@@ -121,41 +162,23 @@ bool BaxterInterface::goToPose(Vectorq7x1 pose, int lr)
   q_in_vecxd = pose;
   des_path.push_back(q_in_vecxd);
 
-  ts.stuff_left_trajectory(des_path, des_trajectory);
+  traj_streamer_->stuff_left_trajectory(des_path, des_trajectory);
 
   baxter_traj_streamer::trajGoal goal;
   goal.trajectory = des_trajectory;
 
-  actionlib::SimpleActionClient<baxter_traj_streamer::trajAction> action_client("trajActionServer", true);
-
-  ROS_DEBUG("Waiting for server: ");
-
-  if (!action_client.waitForServer(ros::Duration(5.0)))
-  {
-    ROS_WARN("Could not connect to server.");
-    return false;
-  }
-
-  ROS_DEBUG("Connected to action server");
-
-  g_count++;
-  goal.traj_id = g_count;
-
-  if (lr != 1 && lr != 0)
-  {
-    ROS_WARN("left or right arm not selected.  halting.");
-    return false;
-  }
+  traj_count_++;
+  goal.traj_id = traj_count_;
 
   goal.left_or_right = lr;
 
-  ROS_DEBUG("Sending traj_id %d", g_count);
+  ROS_DEBUG("Sending traj_id %d", traj_count_);
 
-  action_client.sendGoal(goal, boost::bind(&BaxterInterface::doneCb, this, _1, _2));
+  action_client_->sendGoal(goal, boost::bind(&BaxterInterface::doneCb, this, _1, _2));
 
-  if (!action_client.waitForResult(ros::Duration(5.0)))
+  if (!action_client_->waitForResult(ros::Duration(5.0)))
   {
-    ROS_WARN("Giving up waiting on result for traj_id: %d", g_count);
+    ROS_WARN("Giving up waiting on result for traj_id: %d", traj_count_);
     return false;
   }
   else
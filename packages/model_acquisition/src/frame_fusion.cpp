@@ -0,0 +1,156 @@
+/*
+ * frame_fusion
+ *
+ * Copyright (c) 2015, Luc Bettaieb
+ * BSD Licensed
+ */
+
+#include "model_acquisition/frame_fusion.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+namespace
+{
+const float NaN = std::numeric_limits<float>::quiet_NaN();
+
+void setInvalid(pcl::PointXYZRGB &point)
+{
+  point.x = point.y = point.z = NaN;
+}
+
+// True when neighbour is valid and further than threshold times depth from it.
+// An invalid neighbour says nothing about the pixel.
+bool jumps(float depth, float neighbour, double threshold)
+{
+  return std::isfinite(neighbour) && std::fabs(depth - neighbour) > threshold * depth;
+}
+}
+
+bool parseFusionMode(const std::string &name, FusionMode &mode)
+{
+  if (name == "none")
+    mode = FUSION_NONE;
+  else if (name == "median")
+    mode = FUSION_MEDIAN;
+  else if (name == "mean")
+    mode = FUSION_MEAN;
+  else
+    return false;
+
+  return true;
+}
+
+bool fuseFrames(const std::vector<pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr> &frames,
+                const FusionParams &params, pcl::PointCloud<pcl::PointXYZRGB> &fused)
+{
+  if (frames.empty() || frames[0]->height <= 1)
+    return false;
+
+  size_t width = frames[0]->width;
+  size_t height = frames[0]->height;
+  for (size_t f = 1; f < frames.size(); f++)
+  {
+    if (frames[f]->width != width || frames[f]->height != height)
+      return false;
+  }
+
+  pcl::PointCloud<pcl::PointXYZRGB> out;
+  out.header = frames[0]->header;
+  out.points.resize(width * height);
+  out.width = width;
+  out.height = height;
+  out.is_dense = false;
+
+  size_t min_inliers = frames.size() / 2 + 1;
+  // (depth, frame) of the valid samples of one pixel
+  std::vector<std::pair<float, size_t> > samples;
+  samples.reserve(frames.size());
+
+  for (size_t p = 0; p < out.points.size(); p++)
+  {
+    samples.clear();
+    for (size_t f = 0; f < frames.size(); f++)
+    {
+      const pcl::PointXYZRGB &point = frames[f]->points[p];
+      if (std::isfinite(point.x) && std::isfinite(point.y) && std::isfinite(point.z))
+        samples.push_back(std::make_pair(point.z, f));
+    }
+
+    pcl::PointXYZRGB &result = out.points[p];
+    if (samples.size() < min_inliers)
+    {
+      setInvalid(result);
+      continue;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    const std::pair<float, size_t> &median = samples[samples.size() / 2];
+    float tolerance = params.max_deviation * median.first;
+
+    double sum[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+    size_t inliers = 0;
+    for (size_t s = 0; s < samples.size(); s++)
+    {
+      if (std::fabs(samples[s].first - median.first) > tolerance)
+        continue;
+
+      const pcl::PointXYZRGB &point = frames[samples[s].second]->points[p];
+      sum[0] += point.x;
+      sum[1] += point.y;
+      sum[2] += point.z;
+      sum[3] += point.r;
+      sum[4] += point.g;
+      sum[5] += point.b;
+      inliers++;
+    }
+
+    if (inliers < min_inliers)
+    {
+      setInvalid(result);
+      continue;
+    }
+
+    // The median sample keeps x, y and z on one camera ray
+    result = frames[median.second]->points[p];
+    if (params.mode == FUSION_MEAN)
+    {
+      result.x = sum[0] / inliers;
+      result.y = sum[1] / inliers;
+      result.z = sum[2] / inliers;
+      result.r = static_cast<uint8_t>(sum[3] / inliers + 0.5);
+      result.g = static_cast<uint8_t>(sum[4] / inliers + 0.5);
+      result.b = static_cast<uint8_t>(sum[5] / inliers + 0.5);
+    }
+  }
+
+  // Judged on the fused depths before any pixel is dropped, so the result does
+  // not depend on the order pixels are visited in
+  std::vector<float> depth(out.points.size());
+  for (size_t p = 0; p < out.points.size(); p++)
+    depth[p] = out.points[p].z;
+
+  for (size_t row = 0; row < height; row++)
+  {
+    for (size_t col = 0; col < width; col++)
+    {
+      size_t p = row * width + col;
+      float z = depth[p];
+      if (!std::isfinite(z))
+        continue;
+
+      bool horizontal = col > 0 && col + 1 < width
+          && jumps(z, depth[p - 1], params.flying_threshold) && jumps(z, depth[p + 1], params.flying_threshold);
+      bool vertical = row > 0 && row + 1 < height
+          && jumps(z, depth[p - width], params.flying_threshold)
+          && jumps(z, depth[p + width], params.flying_threshold);
+      if (horizontal || vertical)
+        setInvalid(out.points[p]);
+    }
+  }
+
+  fused.swap(out);
+  return true;
+}
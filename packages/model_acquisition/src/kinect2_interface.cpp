@@ -7,6 +7,8 @@
 
 #include "model_acquisition/kinect2_interface.h"
 
+#include <algorithm>
+
 ros::Subscriber g_getPointCloud;
 
 std::string g_prev_obj_name;
@@ -18,7 +20,7 @@ std::string home = "~/.ros";
 
 // uint g_snapshot_number;
 
-Kinect2Interface::Kinect2Interface(ros::NodeHandle &nh):p_pclKinect(new pcl::PointCloud<pcl::PointXYZRGB>)
+Kinect2Interface::Kinect2Interface(ros::NodeHandle &nh)
 {
   nh_ = nh;
   // g_snapshot_number = 0;
@@ -28,28 +30,131 @@ Kinect2Interface::Kinect2Interface(ros::NodeHandle &nh):p_pclKinect(new pcl::Poi
   if (!nh.getParam("model_acquisition/scan_topic", g_scan_topic))
     g_scan_topic = "/kinect2/qhd/points";  // Default behavior
 
-  g_getPointCloud = nh.subscribe<sensor_msgs::PointCloud2> (g_scan_topic, 1, &Kinect2Interface::kinectCB, this);
+  std::string pcd_format;
+  if (!nh.getParam("model_acquisition/pcd_format", pcd_format))
+    pcd_format = "binary";  // Default behavior, read in place by model_processing
+
+  if (!parsePcdFormat(pcd_format, pcd_format_))
+  {
+    ROS_WARN("Unknown pcd_format '%s', falling back to binary", pcd_format.c_str());
+    pcd_format_ = PCD_BINARY;
+  }
+
+  std::string fusion;
+  if (!nh.getParam("model_acquisition/fusion", fusion))
+    fusion = "none";  // Default behavior
+
+  if (!parseFusionMode(fusion, fusion_.mode))
+  {
+    ROS_WARN("Unknown fusion '%s', writing every frame", fusion.c_str());
+    fusion_.mode = FUSION_NONE;
+  }
+
+  if (!nh.getParam("model_acquisition/fusion_max_deviation", fusion_.max_deviation))
+    fusion_.max_deviation = 0.02;  // Default behavior
+
+  if (!nh.getParam("model_acquisition/fusion_flying_threshold", fusion_.flying_threshold))
+    fusion_.flying_threshold = 0.05;  // Default behavior
+
+  int writer_queue_size;
+  if (!nh.getParam("model_acquisition/writer_queue_size", writer_queue_size))
+    writer_queue_size = 8;  // Default behavior
+  writer_.reset(new SnapshotWriter(pcd_format_, std::max(1, writer_queue_size), fusion_));
+
+  int frame_buffer_size;
+  if (!nh.getParam("model_acquisition/frame_buffer_size", frame_buffer_size))
+    frame_buffer_size = 10;  // Default behavior
+  frame_buffer_size_ = std::max(1, frame_buffer_size);
+
+  double frame_timeout;
+  if (!nh.getParam("model_acquisition/frame_timeout", frame_timeout))
+    frame_timeout = 2.0;  // Default behavior
+  frame_timeout_ = ros::Duration(frame_timeout);
+
+  g_getPointCloud = nh.subscribe<sensor_msgs::PointCloud2> (g_scan_topic, frame_buffer_size_,
+                                                            &Kinect2Interface::kinectCB, this);
 }
 
 Kinect2Interface::~Kinect2Interface()
 {
-  // Do I need to delete things here?
+  // writer_ writes out whatever is still queued
 }
 
 void Kinect2Interface::kinectCB(const sensor_msgs::PointCloud2ConstPtr &cloud)
 {
-  pcl::fromROSMsg(*cloud, *p_pclKinect);
-  // ROS_INFO("kinectCB %d * %d points", (int) g_pclKinect->width, (int) g_pclKinect->height);
+  // Runs at the camera's frame rate, so only the shared message is kept here
+  StampedFrame frame;
+  frame.stamp = cloud->header.stamp.isZero() ? ros::Time::now() : cloud->header.stamp;
+  frame.cloud = cloud;
+
+  if (frames_.size() == frame_buffer_size_)
+    frames_.pop_front();
+  frames_.push_back(frame);
+}
+
+ros::Time Kinect2Interface::frameStamp(const sensor_msgs::PointCloud2ConstPtr &frame) const
+{
+  for (std::deque<StampedFrame>::const_iterator it = frames_.begin(); it != frames_.end(); ++it)
+  {
+    if (it->cloud == frame)
+      return it->stamp;
+  }
+  return frame->header.stamp;
+}
+
+sensor_msgs::PointCloud2ConstPtr Kinect2Interface::getFrameAfter(const ros::Time &stamp)
+{
+  return getFrameAfter(stamp, frame_timeout_);
+}
+
+sensor_msgs::PointCloud2ConstPtr Kinect2Interface::getFrameAfter(const ros::Time &stamp, const ros::Duration &timeout)
+{
+  ros::Time deadline = ros::Time::now() + timeout;
+
+  while (ros::ok())
+  {
+    ros::spinOnce();
+
+    for (std::deque<StampedFrame>::const_iterator it = frames_.begin(); it != frames_.end(); ++it)
+    {
+      if (it->stamp > stamp)
+        return it->cloud;
+    }
+
+    if (ros::Time::now() >= deadline)
+      break;
+    ros::Duration(0.005).sleep();
+  }
+
+  return sensor_msgs::PointCloud2ConstPtr();
 }
 
 void Kinect2Interface::snapshot(std::string obj_name, uint snapshot_num, double snapshot_angle)
 {
   ros::spinOnce();
+
+  sensor_msgs::PointCloud2ConstPtr latest;
+  if (!frames_.empty())
+    latest = frames_.back().cloud;
+
+  snapshot(latest, obj_name, snapshot_num, snapshot_angle);
+}
+
+bool Kinect2Interface::snapshot(const sensor_msgs::PointCloud2ConstPtr &frame, std::string obj_name,
+                                uint snapshot_num, double snapshot_angle)
+{
   std::string file_name;
 
   file_name = obj_name + boost::to_string(snapshot_angle) + "-" + boost::to_string(snapshot_num);
 
-  pcl::io::savePCDFileASCII(file_name + ".pcd", *p_pclKinect);
+  if (!frame)
+  {
+    ROS_WARN("No cloud received on %s, skipping snapshot %s", g_scan_topic.c_str(), file_name.c_str());
+    return false;
+  }
+
+  writer_->write(file_name + ".pcd", frame);
+  return true;
   // if (g_snapshot_number > 0 && obj_name.compare(g_prev_obj_name) != 0)
   //   g_snapshot_number = 0;
   // else
@@ -58,3 +163,33 @@ void Kinect2Interface::snapshot(std::string obj_name, uint snapshot_num, double
   //   g_prev_obj_name = obj_name;
   // }
 }
+
+bool Kinect2Interface::snapshot(const std::vector<sensor_msgs::PointCloud2ConstPtr> &frames, std::string obj_name,
+                                uint snapshot_num, double snapshot_angle)
+{
+  if (frames.size() == 1)
+    return snapshot(frames[0], obj_name, snapshot_num, snapshot_angle);
+
+  std::string file_name;
+
+  file_name = obj_name + boost::to_string(snapshot_angle) + "-" + boost::to_string(snapshot_num);
+
+  if (frames.empty())
+  {
+    ROS_WARN("No cloud received on %s, skipping snapshot %s", g_scan_topic.c_str(), file_name.c_str());
+    return false;
+  }
+
+  writer_->write(file_name + ".pcd", frames);
+  return true;
+}
+
+bool Kinect2Interface::fusesFrames() const
+{
+  return fusion_.mode != FUSION_NONE;
+}
+
+size_t Kinect2Interface::flush()
+{
+  return writer_->flush();
+}
@@ -39,6 +39,10 @@ bool acquireModel(model_acquisition::acquire::Request &request,
   ros::spinOnce();
   ROS_INFO("Acquire Model!");
 
+  // Frames that didn't arrive in time, and angles that got none of them
+  int missed_frames = 0;
+  int missed_angles = 0;
+
   for (double d = -M_PI; d < M_PI; d += g_increment_radians)
   {
     g_vec_scan_pose(6, 0) = d;
@@ -46,18 +50,48 @@ bool acquireModel(model_acquisition::acquire::Request &request,
     
     baxter->goToPose(g_vec_scan_pose, 1);
 
+    // goToPose returns once the trajectory is done, frames stamped before
+    // now may have been captured while the arm was still moving
+    ros::Time settled = ros::Time::now();
+
     ROS_INFO("snapshot");
-    
+
+    // With fusion the frames of an angle become a single snapshot, numbered 0
+    std::vector<sensor_msgs::PointCloud2ConstPtr> frames;
+    int captured = 0;
     for (int i = 0; i < g_n_snapshots; i++)
     {
-      
-      kinect->snapshot(request.model_name, i, angles::to_degrees(d));
+      sensor_msgs::PointCloud2ConstPtr frame = kinect->getFrameAfter(settled);
+      if (!frame)
+      {
+        ROS_WARN("No frame after the arm stopped at %g degrees", angles::to_degrees(d));
+        missed_frames += g_n_snapshots - i;
+        break;
+      }
+      captured++;
+
+      if (kinect->fusesFrames())
+        frames.push_back(frame);
+      else
+        kinect->snapshot(frame, request.model_name, i, angles::to_degrees(d));
+      // Every snapshot of a pose is a different frame
+      settled = kinect->frameStamp(frame);
     }
-    
-    ros::spinOnce();  // This might not be necessary since it's inside kinect2Interface::snapshot already
+
+    if (!frames.empty())
+      kinect->snapshot(frames, request.model_name, 0, angles::to_degrees(d));
+    if (captured == 0 && g_n_snapshots > 0)
+      missed_angles++;
   }
 
-  return true;
+  // Snapshots are written while the arm moves on, wait for the last ones
+  size_t failed = kinect->flush();
+  if (failed > 0)
+    ROS_WARN("%zu snapshots could not be written", failed);
+  if (missed_frames > 0)
+    ROS_WARN("%d frames did not arrive, %d angles got no snapshot", missed_frames, missed_angles);
+
+  return failed == 0 && missed_angles == 0;
 }
 
 int main(int argc, char** argv)
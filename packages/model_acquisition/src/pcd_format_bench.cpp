@@ -0,0 +1,113 @@
+/*
+ * pcd_format_bench
+ * times Kinect2Interface::snapshot's PCD writer for every supported encoding
+ *
+ * Copyright (c) 2015, Luc Bettaieb
+ * BSD Licensed
+ */
+
+#include "model_acquisition/pcd_format.h"
+
+#include <pcl/point_types.h>
+
+#include <sys/stat.h>
+#include <time.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <string>
+
+// Usage: pcd_format_bench [iterations] [output_dir]
+
+static double nowMs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+// Builds an organized cloud the size of a kinect2 qhd frame: a table plane with an
+// object on it, a bit of depth noise and the invalid (NaN) pixels the sensor produces.
+static void makeQhdFrame(pcl::PointCloud<pcl::PointXYZRGB> &cloud)
+{
+  const int width = 960;
+  const int height = 540;
+  const float fx = 540.0f;
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+
+  cloud.width = width;
+  cloud.height = height;
+  cloud.is_dense = false;
+  cloud.points.resize(width * height);
+
+  srand(42);
+  for (int v = 0; v < height; v++)
+  {
+    for (int u = 0; u < width; u++)
+    {
+      pcl::PointXYZRGB &p = cloud.points[v * width + u];
+
+      if (rand() % 20 == 0)
+      {
+        p.x = p.y = p.z = nan;
+        continue;
+      }
+
+      float du = (u - width / 2) / fx;
+      float dv = (v - height / 2) / fx;
+      float z = 1.2f - 0.3f * std::max(0.0f, 0.2f - std::sqrt(du * du + dv * dv));
+      z += 0.002f * (rand() / static_cast<float>(RAND_MAX) - 0.5f);
+
+      p.x = du * z;
+      p.y = dv * z;
+      p.z = z;
+      p.r = static_cast<uint8_t>(u % 256);
+      p.g = static_cast<uint8_t>(v % 256);
+      p.b = 128;
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int iterations = argc > 1 ? atoi(argv[1]) : 10;
+  std::string dir = argc > 2 ? argv[2] : "/tmp";
+
+  if (iterations < 1)
+    iterations = 1;
+
+  pcl::PointCloud<pcl::PointXYZRGB> cloud;
+  makeQhdFrame(cloud);
+
+  printf("%d x %d points, %d iterations\n", cloud.width, cloud.height, iterations);
+  printf("%-18s %14s %14s %12s\n", "format", "bytes", "ms/snapshot", "MB/s");
+
+  const PcdFormat formats[] = { PCD_ASCII, PCD_BINARY, PCD_BINARY_COMPRESSED };
+
+  for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+  {
+    std::string file_name = dir + "/pcd_format_bench_" + pcdFormatName(formats[f]) + ".pcd";
+
+    double start = nowMs();
+    for (int i = 0; i < iterations; i++)
+    {
+      if (writePcd(file_name, cloud, formats[f]) < 0)
+      {
+        fprintf(stderr, "failed to write %s\n", file_name.c_str());
+        return 1;
+      }
+    }
+    double ms = (nowMs() - start) / iterations;
+
+    struct stat st;
+    long long bytes = stat(file_name.c_str(), &st) == 0 ? static_cast<long long>(st.st_size) : -1;
+
+    printf("%-18s %14lld %14.2f %12.1f\n", pcdFormatName(formats[f]), bytes, ms, bytes / (ms * 1e3));
+    remove(file_name.c_str());
+  }
+
+  return 0;
+}
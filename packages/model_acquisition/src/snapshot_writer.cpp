@@ -0,0 +1,134 @@
+/*
+ * snapshot_writer
+ *
+ * Copyright (c) 2015, Luc Bettaieb
+ * BSD Licensed
+ */
+
+#include "model_acquisition/snapshot_writer.h"
+
+#include <ros/ros.h>
+#include <pcl_conversions/pcl_conversions.h>
+#include <pcl/exceptions.h>
+
+#include <algorithm>
+#include <boost/bind.hpp>
+
+SnapshotWriter::SnapshotWriter(PcdFormat format, size_t max_pending, const FusionParams &fusion)
+  : format_(format), fusion_(fusion), max_pending_(std::max<size_t>(1, max_pending)), busy_(false), stopping_(false), failed_(0)
+{
+  thread_ = boost::thread(boost::bind(&SnapshotWriter::writeLoop, this));
+}
+
+SnapshotWriter::~SnapshotWriter()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stopping_ = true;
+  }
+  changed_.notify_all();
+  // The loop drains the queue before it returns
+  thread_.join();
+}
+
+void SnapshotWriter::write(const std::string &file_name, const sensor_msgs::PointCloud2ConstPtr &frame)
+{
+  write(file_name, std::vector<sensor_msgs::PointCloud2ConstPtr>(1, frame));
+}
+
+void SnapshotWriter::write(const std::string &file_name, const std::vector<sensor_msgs::PointCloud2ConstPtr> &frames)
+{
+  if (frames.empty())
+    return;
+
+  Job job;
+  job.file_name = file_name;
+  job.frames = frames;
+
+  boost::mutex::scoped_lock lock(mutex_);
+  while (jobs_.size() >= max_pending_)
+    changed_.wait(lock);
+
+  jobs_.push_back(job);
+  changed_.notify_all();
+}
+
+size_t SnapshotWriter::flush()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  while (!jobs_.empty() || busy_)
+    changed_.wait(lock);
+
+  size_t failed = failed_;
+  failed_ = 0;
+  return failed;
+}
+
+void SnapshotWriter::writeLoop()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  for (;;)
+  {
+    while (jobs_.empty() && !stopping_)
+      changed_.wait(lock);
+    if (jobs_.empty())
+      return;
+
+    Job job = jobs_.front();
+    jobs_.pop_front();
+    busy_ = true;
+    // A slot is free again for write
+    changed_.notify_all();
+    lock.unlock();
+
+    // An exception must not end the thread, flush would never return
+    bool ok = false;
+    try
+    {
+      ok = writeJob(job);
+      if (!ok)
+        ROS_WARN("Failed to write snapshot %s", job.file_name.c_str());
+    }
+    catch (const pcl::PCLException &e)
+    {
+      ROS_WARN("Failed to write snapshot %s: %s", job.file_name.c_str(), e.detailedMessage().c_str());
+    }
+    catch (const std::exception &e)
+    {
+      ROS_WARN("Failed to write snapshot %s: %s", job.file_name.c_str(), e.what());
+    }
+
+    lock.lock();
+    busy_ = false;
+    if (!ok)
+      failed_++;
+    changed_.notify_all();
+  }
+}
+
+bool SnapshotWriter::writeJob(const Job &job)
+{
+  if (job.frames.size() > 1)
+  {
+    std::vector<pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr> clouds;
+    for (size_t i = 0; i < job.frames.size(); i++)
+    {
+      pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZRGB>);
+      pcl::fromROSMsg(*job.frames[i], *cloud);
+      clouds.push_back(cloud);
+    }
+
+    pcl::PointCloud<pcl::PointXYZRGB> fused;
+    if (fuseFrames(clouds, fusion_, fused))
+      return writePcd(job.file_name, fused, format_) >= 0;
+
+    ROS_WARN("Frames for %s are not organized alike, writing the first one unfused", job.file_name.c_str());
+  }
+
+  // The message payload is written with its own fields, one copy of the data
+  // instead of a per-point conversion to PointXYZRGB
+  pcl::PCLPointCloud2 cloud;
+  pcl_conversions::toPCL(*job.frames[0], cloud);
+  return writePcd(job.file_name, cloud, format_) >= 0;
+}
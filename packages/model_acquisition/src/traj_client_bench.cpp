@@ -0,0 +1,170 @@
+/*
+ * traj_client_bench
+ * times BaxterInterface::goToPose against a stand-in trajActionServer, with the
+ * traj streamer and action client set up per call (as goToPose used to) and once
+ *
+ * Copyright (c) 2015, Luc Bettaieb
+ * BSD Licensed
+ */
+
+#include "model_acquisition/baxter_interface.h"
+
+#include <actionlib/server/simple_action_server.h>
+#include <ros/callback_queue.h>
+
+#include <time.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// Usage: traj_client_bench [iterations] [motion_ms]
+// Must not run next to a real trajActionServer.
+
+typedef actionlib::SimpleActionServer<baxter_traj_streamer::trajAction> TrajActionServer;
+
+static double nowMs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+// Accepts every trajectory and "moves" for motion_ms
+static void executeTraj(TrajActionServer *server, double motion_ms, const baxter_traj_streamer::trajGoalConstPtr &goal)
+{
+  ros::WallDuration(motion_ms / 1e3).sleep();
+
+  baxter_traj_streamer::trajResult result;
+  result.return_val = 0;
+  result.traj_id = goal->traj_id;
+  server->setSucceeded(result);
+}
+
+// Stands in for the robot's joint states, getLeftArmPose reads positions 2 to 8
+static void publishJointStates(ros::Publisher *publisher, const ros::TimerEvent &)
+{
+  sensor_msgs::JointState state;
+  state.header.stamp = ros::Time::now();
+  state.position.resize(9, 0.0);
+  publisher->publish(state);
+}
+
+// goToPose as it was before the streamer and client became members
+static bool legacyGoToPose(ros::NodeHandle &nh, const Vectorq7x1 &pose, uint traj_id)
+{
+  Baxter_traj_streamer ts(&nh);
+
+  for (uint i = 0; i < 100; i++)
+  {
+    ros::spinOnce();
+    ros::Duration(0.01).sleep();
+  }
+
+  std::vector<Eigen::VectorXd> des_path;
+  Eigen::VectorXd q_in_vecxd = Vectorq7x1::Zero();
+  des_path.push_back(q_in_vecxd);
+  q_in_vecxd = pose;
+  des_path.push_back(q_in_vecxd);
+
+  trajectory_msgs::JointTrajectory des_trajectory;
+  ts.stuff_left_trajectory(des_path, des_trajectory);
+
+  baxter_traj_streamer::trajGoal goal;
+  goal.trajectory = des_trajectory;
+  goal.traj_id = traj_id;
+  goal.left_or_right = 1;
+
+  actionlib::SimpleActionClient<baxter_traj_streamer::trajAction> action_client("trajActionServer", true);
+  if (!action_client.waitForServer(ros::Duration(5.0)))
+    return false;
+
+  action_client.sendGoal(goal);
+  return action_client.waitForResult(ros::Duration(5.0));
+}
+
+static void report(const char *name, std::vector<double> &ms)
+{
+  std::sort(ms.begin(), ms.end());
+
+  double total = 0.0;
+  for (size_t i = 0; i < ms.size(); i++)
+    total += ms[i];
+
+  printf("%-12s %12.1f %12.1f %12.1f %12.1f\n", name, total / ms.size(), ms[ms.size() / 2], ms.back(), total);
+}
+
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "traj_client_bench");
+
+  int iterations = argc > 1 ? atoi(argv[1]) : 18;  // One scan at 20 degree increments
+  double motion_ms = argc > 2 ? atof(argv[2]) : 0.0;
+
+  if (iterations < 1)
+    iterations = 1;
+
+  ros::NodeHandle nh;
+
+  // The stand-ins get their own queue and thread, goToPose spins the global one
+  ros::CallbackQueue server_queue;
+  ros::NodeHandle server_nh;
+  server_nh.setCallbackQueue(&server_queue);
+
+  TrajActionServer server(server_nh, "trajActionServer", boost::bind(&executeTraj, &server, motion_ms, _1), false);
+  server.start();
+
+  ros::Publisher joint_publisher = server_nh.advertise<sensor_msgs::JointState>("/robot/joint_states", 3);
+  ros::Timer joint_timer = server_nh.createTimer(ros::Duration(0.01),
+                                                 boost::bind(&publishJointStates, &joint_publisher, _1));
+
+  ros::AsyncSpinner spinner(2, &server_queue);
+  spinner.start();
+
+  Vectorq7x1 pose = Vectorq7x1::Zero();
+
+  printf("%d poses, %.0f ms of motion each\n", iterations, motion_ms);
+  printf("%-12s %12s %12s %12s %12s\n", "client", "mean ms", "median ms", "max ms", "total ms");
+
+  std::vector<double> legacy;
+  for (int i = 0; i < iterations && ros::ok(); i++)
+  {
+    double start = nowMs();
+    if (!legacyGoToPose(nh, pose, i + 1))
+    {
+      fprintf(stderr, "per-call client failed on pose %d\n", i);
+      return 1;
+    }
+    legacy.push_back(nowMs() - start);
+  }
+  report("per call", legacy);
+
+  double setup_start = nowMs();
+  BaxterInterface baxter(nh);
+  double setup_ms = nowMs() - setup_start;
+  if (!baxter.isReady())
+  {
+    fprintf(stderr, "BaxterInterface did not get ready\n");
+    return 1;
+  }
+
+  std::vector<double> persistent;
+  for (int i = 0; i < iterations && ros::ok(); i++)
+  {
+    pose(6, 0) = 0.01 * i;
+
+    double start = nowMs();
+    if (!baxter.goToPose(pose, 1))
+    {
+      fprintf(stderr, "persistent client failed on pose %d\n", i);
+      return 1;
+    }
+    persistent.push_back(nowMs() - start);
+  }
+  report("persistent", persistent);
+  printf("%-12s %12.1f (once, in the BaxterInterface constructor)\n", "setup", setup_ms);
+
+  spinner.stop();
+  return 0;
+}
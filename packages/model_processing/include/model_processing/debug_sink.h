@@ -0,0 +1,53 @@
+#ifndef MODEL_PROCESSING_DEBUG_SINK_H
+#define MODEL_PROCESSING_DEBUG_SINK_H
+
+#include <deque>
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+// Opt-in sink for intermediate clouds (e.g. the clusters object_identification
+// looks at). Clouds are written as binary PCDs to <root>/<goal>/<name> by a
+// background thread, so the caller never waits on the disk. When more than
+// max_queued clouds are pending new ones are dropped rather than blocking.
+class DebugSink
+{
+public:
+  explicit DebugSink (const std::string &root, size_t max_queued = 64);
+  ~DebugSink ();
+
+  // The cloud is shared with the writer thread, don't modify it afterwards
+  void post (const std::string &goal, const std::string &name, pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr cloud);
+
+  // Blocks until everything posted so far is on disk
+  void flush ();
+
+  size_t dropped () const;
+
+private:
+  struct Job
+  {
+    std::string goal;
+    std::string name;
+    pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr cloud;
+  };
+
+  void run ();
+
+  std::string root_;
+  size_t max_queued_;
+  size_t dropped_;
+  bool busy_;
+  bool stop_;
+  std::deque<Job> queue_;
+  mutable boost::mutex mutex_;
+  boost::condition_variable work_;
+  boost::condition_variable idle_;
+  boost::thread thread_;
+};
+
+#endif  // MODEL_PROCESSING_DEBUG_SINK_H
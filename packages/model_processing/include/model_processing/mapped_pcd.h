@@ -0,0 +1,63 @@
+#ifndef MODEL_PROCESSING_MAPPED_PCD_H
+#define MODEL_PROCESSING_MAPPED_PCD_H
+
+#include <stdint.h>
+#include <cstring>
+#include <string>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+// Read-only view of a binary PCD file mapped straight into memory.
+// The point data is never parsed or copied; x/y/z/rgb are read in place
+// from the mapping. copyTo() materializes a PointCloud for stages that
+// need to mutate the points or hand them to PCL.
+// ASCII and binary_compressed files are not supported, open() returns
+// false for them and callers fall back to pcl::PCDReader.
+class MappedPcd
+{
+public:
+  MappedPcd ();
+  ~MappedPcd ();
+
+  bool open (const std::string &filepath);
+  void close ();
+  bool isOpen () const { return data_ != NULL; }
+
+  size_t size () const { return size_; }
+  uint32_t width () const { return width_; }
+  uint32_t height () const { return height_; }
+  bool hasColor () const { return rgb_offset_ >= 0; }
+
+  float x (size_t i) const { return field (i, x_offset_); }
+  float y (size_t i) const { return field (i, y_offset_); }
+  float z (size_t i) const { return field (i, z_offset_); }
+  float rgb (size_t i) const { return hasColor () ? field (i, rgb_offset_) : 0.0f; }
+
+  void copyTo (pcl::PointCloud<pcl::PointXYZRGB> &cloud) const;
+
+private:
+  // Non-copyable, the mapping is owned
+  MappedPcd (const MappedPcd &);
+  MappedPcd &operator= (const MappedPcd &);
+
+  float field (size_t i, int offset) const
+  {
+    float v;
+    std::memcpy (&v, data_ + i * point_step_ + offset, sizeof (float));
+    return v;
+  }
+
+  void *map_;
+  size_t map_size_;
+  const uint8_t *data_;
+  size_t size_;
+  size_t point_step_;
+  uint32_t width_;
+  uint32_t height_;
+  int x_offset_;
+  int y_offset_;
+  int z_offset_;
+  int rgb_offset_;
+};
+
+#endif  // MODEL_PROCESSING_MAPPED_PCD_H
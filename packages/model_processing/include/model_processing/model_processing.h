@@ -1,18 +1,80 @@
+#ifndef MODEL_PROCESSING_MODEL_PROCESSING_H
+#define MODEL_PROCESSING_MODEL_PROCESSING_H
+
 #include <string>
 #include <Eigen/Eigen>
 #include <Eigen/Dense>
 #include <Eigen/Geometry>
+#include <boost/shared_ptr.hpp>
+#include <pcl/pcl_base.h>
 #include <pcl/common/impl/common.hpp>
+#include <model_processing/debug_sink.h>
+
+// Result of ModelProcessing::cloud_stats, NaN points are skipped.
+// covariance is normalized by n_valid.
+struct CloudStats
+{
+  Eigen::Vector3f min;
+  Eigen::Vector3f max;
+  Eigen::Vector3f centroid;
+  Eigen::Matrix3f covariance;
+  size_t n_valid;
+};
+
+// Search structure used by object_identification to cluster the points left
+// after plane removal
+enum ClusteringEngine
+{
+  KDTREE_CLUSTERING,
+  VOXEL_HASH_CLUSTERING
+};
 
 class ModelProcessing
 {
 public:
+ModelProcessing ();
+void set_clustering_engine (ClusteringEngine engine);
+// Dumps the clusters object_identification considers to <sink root>/<goal>/,
+// pass an empty pointer to turn the dumps off again
+void set_debug_sink (boost::shared_ptr<DebugSink> sink, const std::string &goal);
+// RANSAC settings for peel_planes, planes are removed until remaining_fraction of the points is left
+void set_plane_segmentation (int max_iterations, double distance_threshold, double remaining_fraction);
+// Euclidean clustering settings for object_identification
+void set_cluster_extraction (double tolerance, int min_size, int max_size);
 
 pcl::PointCloud<pcl::PointXYZRGB>::Ptr pcd_reader (std::string filepath);
-pcl::PointCloud<pcl::PointXYZRGB>::Ptr remove_outlier (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud);
-pcl::PointCloud<pcl::PointXYZRGB>::Ptr downsampler (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud);
+// Statistical outlier removal, same output as pcl::StatisticalOutlierRemoval.
+// n_threads <= 0 uses the calling thread's OpenMP default (every core unless
+// lowered with omp_set_num_threads).
+pcl::PointCloud<pcl::PointXYZRGB>::Ptr remove_outlier (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, int mean_k = 50, double stddev_mult = 1.0, int n_threads = 0);
+void remove_outlier (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, pcl::PointCloud<pcl::PointXYZRGB> &output, int mean_k = 50, double stddev_mult = 1.0, int n_threads = 0);
+pcl::PointCloud<pcl::PointXYZRGB>::Ptr downsampler (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, float leaf_size = 0.001f);
+void downsampler (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, pcl::PointCloud<pcl::PointXYZRGB> &output, float leaf_size = 0.001f);
 void bounding_box (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, float (&minMax)[6]);
 Eigen::Vector3f computeCentroid (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud);
+// Bounding box, centroid, covariance and valid point count in one pass
+CloudStats cloud_stats (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud);
+// Removes dominant planes (RANSAC) from the index set remaining until the
+// remaining fraction of it is left (30% by default). Returns the number of
+// planes removed, cloud is not modified.
+int peel_planes (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, pcl::IndicesPtr remaining);
 pcl::PointCloud<pcl::PointXYZRGB>::Ptr object_identification (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, int minPointRange, int maxPointRange);
+void object_identification (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, int minPointRange, int maxPointRange, pcl::PointCloud<pcl::PointXYZRGB> &output);
 std::string pcd_writer (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, std::string filepath);
+// Writes cloud to name + "_processed.pcd" and returns that path, directories
+// in name are created
+std::string write_processed (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, const std::string &name);
+
+private:
+ClusteringEngine clustering_engine_;
+boost::shared_ptr<DebugSink> debug_sink_;
+std::string debug_goal_;
+int ransac_iterations_;
+double plane_distance_;
+double remaining_fraction_;
+double cluster_tolerance_;
+int min_cluster_size_;
+int max_cluster_size_;
 };
+
+#endif  // MODEL_PROCESSING_MODEL_PROCESSING_H
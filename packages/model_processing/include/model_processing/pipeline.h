@@ -0,0 +1,87 @@
+#ifndef MODEL_PROCESSING_PIPELINE_H
+#define MODEL_PROCESSING_PIPELINE_H
+
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <ros/ros.h>
+#include <model_processing/model_processing.h>
+
+// Wall time and cloud sizes of one stage of a Pipeline::run
+struct StageTiming
+{
+  std::string name;
+  double milliseconds;
+  size_t points_in;
+  size_t points_out;
+};
+
+// One step of a Pipeline. Stages hold their own parameters and apply them
+// through the shared ModelProcessing instance.
+class PipelineStage
+{
+public:
+  virtual ~PipelineStage () {}
+
+  virtual std::string name () const = 0;
+
+  // name plus parameter values, e.g. "outlier_removal(mean_k=50,stddev_mult=1,threads=0)"
+  virtual std::string describe () const = 0;
+
+  // output is a scratch cloud owned by the pipeline, it never aliases input
+  virtual void process (ModelProcessing &model_processing, pcl::PointCloud<pcl::PointXYZRGB>::Ptr input,
+                        pcl::PointCloud<pcl::PointXYZRGB> &output) = 0;
+};
+
+// Chain of processing stages built from configuration, e.g. loaded from YAML
+// onto the parameter server:
+//
+//   pipeline:
+//     - stage: outlier_removal
+//       mean_k: 50
+//       stddev_mult: 1.0
+//
+// Stages: downsample (leaf_size), outlier_removal (mean_k, stddev_mult, threads),
+// object_identification (min_points, max_points, ransac_iterations,
+// plane_distance, remaining_fraction, cluster_tolerance, min_cluster_size,
+// max_cluster_size, clustering: kdtree | voxel_hash).
+//
+// Clouds are passed between stages through two buffers owned by the pipeline,
+// so after the first run no stage allocates a new output cloud.
+// A Pipeline is not meant to be shared between threads.
+class Pipeline
+{
+public:
+  Pipeline ();
+
+  // 1 mm voxel downsampling followed by outlier removal with pcl's defaults
+  void load_default ();
+
+  // Replaces the current stages. On failure the stages are left untouched and
+  // error says which entry was rejected.
+  bool load (XmlRpc::XmlRpcValue &config, std::string &error);
+  bool load (const ros::NodeHandle &nh, const std::string &param, std::string &error);
+
+  void add_stage (boost::shared_ptr<PipelineStage> stage);
+  size_t size () const { return stages_.size (); }
+  std::string describe () const;
+
+  ModelProcessing &model_processing () { return model_processing_; }
+
+  // Runs all stages on input, which is not modified. The returned cloud is one
+  // of the pipeline's buffers (or input itself for an empty pipeline) and is
+  // overwritten by the next run.
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr run (pcl::PointCloud<pcl::PointXYZRGB>::Ptr input,
+                                              std::vector<StageTiming> &timings);
+
+private:
+  // Copies would share the scratch buffers
+  Pipeline (const Pipeline &);
+  Pipeline &operator= (const Pipeline &);
+
+  ModelProcessing model_processing_;
+  std::vector<boost::shared_ptr<PipelineStage> > stages_;
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr buffers_[2];
+};
+
+#endif  // MODEL_PROCESSING_PIPELINE_H
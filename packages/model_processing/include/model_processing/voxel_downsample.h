@@ -0,0 +1,17 @@
+#ifndef MODEL_PROCESSING_VOXEL_DOWNSAMPLE_H
+#define MODEL_PROCESSING_VOXEL_DOWNSAMPLE_H
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+// Voxel grid filter that sorts the points by voxel instead of indexing a dense
+// grid, so the extent of the cloud is not limited by leaf_size the way
+// pcl::VoxelGrid's 32 bit voxel index is (a full Kinect frame at 1 mm already
+// overflows it). Every occupied voxel is replaced by the mean of its points,
+// x/y/z and r/g/b averaged separately. Non-finite points are skipped.
+// Voxels come out in the same order as from pcl::VoxelGrid (x fastest, z
+// slowest), output is unorganized and dense and must not be cloud itself.
+void voxel_downsample (const pcl::PointCloud<pcl::PointXYZRGB> &cloud, float leaf_size,
+                       pcl::PointCloud<pcl::PointXYZRGB> &output);
+
+#endif  // MODEL_PROCESSING_VOXEL_DOWNSAMPLE_H
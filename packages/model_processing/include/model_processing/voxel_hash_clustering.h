@@ -0,0 +1,24 @@
+#ifndef MODEL_PROCESSING_VOXEL_HASH_CLUSTERING_H
+#define MODEL_PROCESSING_VOXEL_HASH_CLUSTERING_H
+
+#include <vector>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/PointIndices.h>
+
+// Euclidean cluster extraction without a search tree.
+// The points in indices are hashed into a grid whose cells are tolerance / sqrt(3)
+// wide, so all points of a cell are closer than tolerance and form one component.
+// Neighbours of a point lie in cells up to 2 steps away along each axis, except
+// the 8 corner cells at (+-2, +-2, +-2) which are at least tolerance away.
+// Neighbouring cells are linked with a lock-free union-find as soon as one pair
+// of their points is closer than tolerance, cells are processed in parallel.
+// Output follows pcl::EuclideanClusterExtraction: clusters of min_size to
+// max_size points, indices sorted inside each cluster, clusters largest first.
+// Returns false (clusters untouched) if the points span more than 2^21 cells
+// along an axis, the caller should fall back to pcl's extraction then.
+bool voxel_hash_clustering (const pcl::PointCloud<pcl::PointXYZRGB> &cloud, const std::vector<int> &indices,
+                            float tolerance, int min_size, int max_size,
+                            std::vector<pcl::PointIndices> &clusters);
+
+#endif  // MODEL_PROCESSING_VOXEL_HASH_CLUSTERING_H
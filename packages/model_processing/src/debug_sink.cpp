@@ -0,0 +1,94 @@
+#include <iostream>
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <pcl/exceptions.h>
+#include <pcl/io/pcd_io.h>
+#include <model_processing/debug_sink.h>
+
+DebugSink::DebugSink (const std::string &root, size_t max_queued)
+  : root_ (root), max_queued_ (max_queued), dropped_ (0), busy_ (false), stop_ (false)
+{
+  thread_ = boost::thread (boost::bind (&DebugSink::run, this));
+}
+
+DebugSink::~DebugSink ()
+{
+  {
+    boost::mutex::scoped_lock lock (mutex_);
+    stop_ = true;
+  }
+  work_.notify_all ();
+  thread_.join ();
+}
+
+void DebugSink::post (const std::string &goal, const std::string &name, pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr cloud)
+{
+  {
+    boost::mutex::scoped_lock lock (mutex_);
+    if (queue_.size () >= max_queued_)
+    {
+      dropped_++;
+      return;
+    }
+    Job job;
+    job.goal = goal;
+    job.name = name;
+    job.cloud = cloud;
+    queue_.push_back (job);
+  }
+  work_.notify_one ();
+}
+
+void DebugSink::flush ()
+{
+  boost::mutex::scoped_lock lock (mutex_);
+  while (!queue_.empty () || busy_)
+    idle_.wait (lock);
+}
+
+size_t DebugSink::dropped () const
+{
+  boost::mutex::scoped_lock lock (mutex_);
+  return dropped_;
+}
+
+void DebugSink::run ()
+{
+  pcl::PCDWriter writer;
+
+  for (;;)
+  {
+    Job job;
+    {
+      boost::mutex::scoped_lock lock (mutex_);
+      busy_ = false;
+      idle_.notify_all ();
+      while (queue_.empty () && !stop_)
+        work_.wait (lock);
+      // Whatever is still queued at shutdown gets written before exiting
+      if (queue_.empty ())
+        return;
+      job = queue_.front ();
+      queue_.pop_front ();
+      busy_ = true;
+    }
+
+    // Nothing may escape this thread, a failed debug dump must not terminate the process
+    try
+    {
+      boost::filesystem::path dir = boost::filesystem::path (root_) / job.goal;
+      boost::filesystem::create_directories (dir);
+      std::string filepath = (dir / job.name).string ();
+      if (writer.writeBinary (filepath, *job.cloud) != 0)
+        std::cerr << "DebugSink: could not write " << filepath << std::endl;
+    }
+    catch (const pcl::PCLException &e)
+    {
+      std::cerr << "DebugSink: " << e.detailedMessage () << std::endl;
+    }
+    catch (const std::exception &e)
+    {
+      std::cerr << "DebugSink: " << e.what () << std::endl;
+    }
+  }
+}
@@ -1,10 +0,0 @@
-
-
-std::String filepath = "C://blahblah/name.PCD";    
-
-cout << "Hello"
-
-cout << filepath[1];
-cout << filepath[2];
-
-
@@ -0,0 +1,126 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cmath>
+#include <pcl/io/pcd_io.h>
+#include <model_processing/mapped_pcd.h>
+
+namespace
+{
+int find_field (const pcl::PCLPointCloud2 &header, const std::string &name, bool allow_uint32)
+{
+  for (size_t i = 0; i < header.fields.size (); ++i)
+  {
+    const pcl::PCLPointField &f = header.fields[i];
+    if (f.name != name || f.count != 1)
+      continue;
+    if (f.datatype == pcl::PCLPointField::FLOAT32 || (allow_uint32 && f.datatype == pcl::PCLPointField::UINT32))
+      return static_cast<int> (f.offset);
+  }
+  return -1;
+}
+}
+
+MappedPcd::MappedPcd ()
+  : map_ (NULL), map_size_ (0), data_ (NULL), size_ (0), point_step_ (0), width_ (0), height_ (0),
+    x_offset_ (-1), y_offset_ (-1), z_offset_ (-1), rgb_offset_ (-1)
+{
+}
+
+MappedPcd::~MappedPcd ()
+{
+  close ();
+}
+
+bool MappedPcd::open (const std::string &filepath)
+{
+  close ();
+
+  pcl::PCDReader reader;
+  pcl::PCLPointCloud2 header;
+  Eigen::Vector4f origin;
+  Eigen::Quaternionf orientation;
+  int pcd_version;
+  int data_type;
+  unsigned int data_idx;
+
+  if (reader.readHeader (filepath, header, origin, orientation, pcd_version, data_type, data_idx) < 0)
+    return false;
+
+  // Only plain binary data can be used in place
+  if (data_type != 1)
+    return false;
+
+  x_offset_ = find_field (header, "x", false);
+  y_offset_ = find_field (header, "y", false);
+  z_offset_ = find_field (header, "z", false);
+  rgb_offset_ = find_field (header, "rgb", true);
+  if (rgb_offset_ < 0)
+    rgb_offset_ = find_field (header, "rgba", true);
+  if (x_offset_ < 0 || y_offset_ < 0 || z_offset_ < 0)
+    return false;
+
+  int fd = ::open (filepath.c_str (), O_RDONLY);
+  if (fd == -1)
+    return false;
+
+  struct stat st;
+  size_t n = static_cast<size_t> (header.width) * header.height;
+  if (fstat (fd, &st) == -1 || static_cast<size_t> (st.st_size) < data_idx + n * header.point_step)
+  {
+    ::close (fd);
+    return false;
+  }
+
+  void *map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close (fd);
+  if (map == MAP_FAILED)
+    return false;
+  madvise (map, st.st_size, MADV_SEQUENTIAL);
+
+  map_ = map;
+  map_size_ = st.st_size;
+  data_ = static_cast<const uint8_t *> (map) + data_idx;
+  size_ = n;
+  point_step_ = header.point_step;
+  width_ = header.width;
+  height_ = header.height;
+  return true;
+}
+
+void MappedPcd::close ()
+{
+  if (map_ != NULL)
+    munmap (map_, map_size_);
+
+  map_ = NULL;
+  map_size_ = 0;
+  data_ = NULL;
+  size_ = 0;
+}
+
+void MappedPcd::copyTo (pcl::PointCloud<pcl::PointXYZRGB> &cloud) const
+{
+  cloud.points.resize (size_);
+  cloud.width = width_;
+  cloud.height = height_;
+
+  bool is_dense = true;
+  for (size_t i = 0; i < size_; ++i)
+  {
+    pcl::PointXYZRGB &p = cloud.points[i];
+    const uint8_t *src = data_ + i * point_step_;
+    std::memcpy (&p.x, src + x_offset_, sizeof (float));
+    std::memcpy (&p.y, src + y_offset_, sizeof (float));
+    std::memcpy (&p.z, src + z_offset_, sizeof (float));
+    if (rgb_offset_ >= 0)
+      std::memcpy (&p.rgb, src + rgb_offset_, sizeof (float));
+    else
+      p.rgb = 0.0f;
+
+    if (!pcl_isfinite (p.x) || !pcl_isfinite (p.y) || !pcl_isfinite (p.z))
+      is_dense = false;
+  }
+  cloud.is_dense = is_dense;
+}
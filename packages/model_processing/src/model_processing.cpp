@@ -1,14 +1,19 @@
 #ifndef MODEL_PROCESSING_H
 #define MODEL_PROCESSING_H
 
-#include <iostream>
+#include <sstream>
+#include <limits>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include <pcl/io/pcd_io.h>
 #include <pcl/point_types.h>
-#include <pcl/filters/voxel_grid.h>
-#include <pcl/filters/statistical_outlier_removal.h>
+#include <pcl/common/io.h>
+#include <pcl/search/organized.h>
+#include <pcl/search/kdtree.h>
 #include <pcl/common/projection_matrix.h>
 #include <pcl/ModelCoefficients.h>
-#include <pcl/filters/extract_indices.h>
 #include <pcl/features/normal_3d.h>
 #include <pcl/kdtree/kdtree.h>
 #include <pcl/sample_consensus/method_types.h>
@@ -16,12 +21,62 @@
 #include <pcl/segmentation/sac_segmentation.h>
 #include <pcl/segmentation/extract_clusters.h>
 #include <pcl/common/impl/common.hpp>
+#include <boost/filesystem.hpp>
 #include <model_processing/model_processing.h>
+#include <model_processing/mapped_pcd.h>
+#include <model_processing/voxel_downsample.h>
+#include <model_processing/voxel_hash_clustering.h>
+
+
+ModelProcessing::ModelProcessing ()
+  : clustering_engine_ (KDTREE_CLUSTERING),
+    ransac_iterations_ (100),
+    plane_distance_ (0.02),
+    remaining_fraction_ (0.3),
+    cluster_tolerance_ (0.02),
+    min_cluster_size_ (100),
+    max_cluster_size_ (25000)
+{
+}
+
+void ModelProcessing::set_plane_segmentation (int max_iterations, double distance_threshold, double remaining_fraction)
+{
+  ransac_iterations_ = max_iterations;
+  plane_distance_ = distance_threshold;
+  remaining_fraction_ = remaining_fraction;
+}
 
+void ModelProcessing::set_cluster_extraction (double tolerance, int min_size, int max_size)
+{
+  cluster_tolerance_ = tolerance;
+  min_cluster_size_ = min_size;
+  max_cluster_size_ = max_size;
+}
+
+void ModelProcessing::set_clustering_engine (ClusteringEngine engine)
+{
+  clustering_engine_ = engine;
+}
+
+void ModelProcessing::set_debug_sink (boost::shared_ptr<DebugSink> sink, const std::string &goal)
+{
+  debug_sink_ = sink;
+  debug_goal_ = goal;
+}
 
 pcl::PointCloud<pcl::PointXYZRGB>::Ptr ModelProcessing::pcd_reader(std::string filepath)
 {
   pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud (new pcl::PointCloud<pcl::PointXYZRGB>);
+
+  // Binary PCDs are decoded straight out of the mapped file, skipping the
+  // PCDReader parse into an intermediate PCLPointCloud2 blob
+  MappedPcd mapped;
+  if (mapped.open (filepath))
+  {
+    mapped.copyTo (*cloud);
+    return cloud;
+  }
+
   // Fill in the cloud data
   pcl::PCDReader reader;
   // Replace the path below with the path where you saved your file
@@ -30,167 +85,284 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr ModelProcessing::pcd_reader(std::string f
 return cloud;
 }
 
-pcl::PointCloud<pcl::PointXYZRGB>::Ptr ModelProcessing::remove_outlier (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud)
+pcl::PointCloud<pcl::PointXYZRGB>::Ptr ModelProcessing::remove_outlier (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, int mean_k, double stddev_mult, int n_threads)
 {
   pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud_filtered (new pcl::PointCloud<pcl::PointXYZRGB>);
+  remove_outlier (cloud, *cloud_filtered, mean_k, stddev_mult, n_threads);
+  return cloud_filtered;
+}
 
-  std::cerr << "Cloud before filtering: " << std::endl;
-  std::cerr << *cloud << std::endl;
+void ModelProcessing::remove_outlier (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, pcl::PointCloud<pcl::PointXYZRGB> &cloud_filtered, int mean_k, double stddev_mult, int n_threads)
+{
+  // Same search method pcl::StatisticalOutlierRemoval picks for its input
+  pcl::search::Search<pcl::PointXYZRGB>::Ptr searcher;
+  if (cloud->isOrganized ())
+    searcher.reset (new pcl::search::OrganizedNeighbor<pcl::PointXYZRGB> ());
+  else
+    searcher.reset (new pcl::search::KdTree<pcl::PointXYZRGB> (false));
+  searcher->setInputCloud (cloud);
+
+#ifdef _OPENMP
+  if (n_threads <= 0)
+    n_threads = omp_get_max_threads ();
+#endif
 
-  // Create the filtering object
-  pcl::StatisticalOutlierRemoval<pcl::PointXYZRGB> sor;
-  sor.setInputCloud (cloud);
-  sor.setMeanK (50);
-  sor.setStddevMulThresh (1.0);
-  sor.filter (*cloud_filtered);
+  // First pass: mean distance of every point to its k nearest neighbours.
+  // The queries are independent, so they are split across threads.
+  int nr_points = static_cast<int> (cloud->points.size ());
+  std::vector<float> distances (nr_points, 0.0f);
+  std::vector<char> valid (nr_points, 0);
 
-  std::cerr << "Cloud after filtering: " << std::endl;
-  std::cerr << *cloud_filtered << std::endl;
+#pragma omp parallel num_threads (n_threads)
+  {
+    std::vector<int> nn_indices (mean_k + 1);
+    std::vector<float> nn_dists (mean_k + 1);
 
-return cloud_filtered;
+#pragma omp for schedule (dynamic, 1024)
+    for (int i = 0; i < nr_points; ++i)
+    {
+      const pcl::PointXYZRGB &p = cloud->points[i];
+      if (!pcl_isfinite (p.x) || !pcl_isfinite (p.y) || !pcl_isfinite (p.z))
+        continue;
+
+      int found = searcher->nearestKSearch (i, mean_k + 1, nn_indices, nn_dists);
+      if (found == 0)
+        continue;
+
+      // Index 0 is the query point itself
+      double dist_sum = 0.0;
+      for (int k = 1; k < found; ++k)
+        dist_sum += sqrt (nn_dists[k]);
+      distances[i] = static_cast<float> (dist_sum / mean_k);
+      valid[i] = 1;
+    }
+  }
+
+  // Second pass: mean and standard deviation of those distances. This is
+  // O(n) next to the searches above and is kept serial and in input order
+  // so the threshold comes out exactly as pcl computes it.
+  double sum = 0.0, sq_sum = 0.0;
+  int valid_distances = 0;
+  for (int i = 0; i < nr_points; ++i)
+  {
+    sum += distances[i];
+    sq_sum += distances[i] * distances[i];
+    valid_distances += valid[i];
+  }
+  double mean = sum / static_cast<double> (valid_distances);
+  double variance = (sq_sum - sum * sum / static_cast<double> (valid_distances)) / (static_cast<double> (valid_distances) - 1);
+  double distance_threshold = mean + stddev_mult * sqrt (variance);
+
+  std::vector<int> indices;
+  indices.reserve (nr_points);
+  for (int i = 0; i < nr_points; ++i)
+  {
+    if (distances[i] <= distance_threshold)
+      indices.push_back (i);
+  }
+  pcl::copyPointCloud (*cloud, indices, cloud_filtered);
 }
 
-pcl::PointCloud<pcl::PointXYZRGB>::Ptr ModelProcessing::downsampler (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud)
+pcl::PointCloud<pcl::PointXYZRGB>::Ptr ModelProcessing::downsampler (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, float leaf_size)
 {
   pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud_filtered (new pcl::PointCloud<pcl::PointXYZRGB>);
+  downsampler (cloud, *cloud_filtered, leaf_size);
+  return cloud_filtered;
+}
 
-  std::cerr << "PointCloud before filtering: " << cloud->width * cloud->height 
-       << " data points (" << pcl::getFieldsList (*cloud) << ").";
+void ModelProcessing::downsampler (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, pcl::PointCloud<pcl::PointXYZRGB> &cloud_filtered, float leaf_size)
+{
+  voxel_downsample (*cloud, leaf_size, cloud_filtered);
+}
 
-  // Create the filtering object
-  pcl::VoxelGrid<pcl::PointXYZRGB> sor;
-  sor.setInputCloud (cloud);
-  sor.setLeafSize (0.001f, 0.001f, 0.001f);
-  sor.filter (*cloud_filtered);
+CloudStats ModelProcessing::cloud_stats (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud)
+{
+  const int nr_points = static_cast<int> (cloud->points.size ());
+  const float limit = std::numeric_limits<float>::max ();
+
+  Eigen::Array4f min_pt = Eigen::Array4f::Constant (limit);
+  Eigen::Array4f max_pt = Eigen::Array4f::Constant (-limit);
+  Eigen::Vector4d sum = Eigen::Vector4d::Zero ();
+  Eigen::Matrix4d sq_sum = Eigen::Matrix4d::Zero ();
+
+  // Bounds and first/second moments are gathered in the same pass. Points
+  // are handled as 4-wide (x, y, z, 1) vectors so Eigen emits SIMD min/max
+  // and multiply-adds, and the homogeneous 1 makes sum(3) the point count.
+  // Large clouds are split across threads and the partials merged.
+#pragma omp parallel if (nr_points > 100000)
+  {
+    Eigen::Array4f local_min = Eigen::Array4f::Constant (limit);
+    Eigen::Array4f local_max = Eigen::Array4f::Constant (-limit);
+    Eigen::Vector4d local_sum = Eigen::Vector4d::Zero ();
+    Eigen::Matrix4d local_sq_sum = Eigen::Matrix4d::Zero ();
 
-  std::cerr << "PointCloud after filtering: " << cloud_filtered->width * cloud_filtered->height 
-       << " data points (" << pcl::getFieldsList (*cloud_filtered) << ").";
+#pragma omp for schedule (static) nowait
+    for (int i = 0; i < nr_points; ++i)
+    {
+      const pcl::PointXYZRGB &p = cloud->points[i];
+      if (!pcl_isfinite (p.x) || !pcl_isfinite (p.y) || !pcl_isfinite (p.z))
+        continue;
 
-  return cloud_filtered;
-}
+      Eigen::Array4f pt (p.x, p.y, p.z, 1.0f);
+      local_min = local_min.min (pt);
+      local_max = local_max.max (pt);
 
-void ModelProcessing::bounding_box (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, float (&minMax)[6]){
+      Eigen::Vector4d pd = pt.matrix ().cast<double> ();
+      local_sum += pd;
+      local_sq_sum.noalias () += pd * pd.transpose ();
+    }
 
-pcl::PointXYZRGB min;// = (new pcl::PointXYZRGB());
-pcl::PointXYZRGB max;// = (new pcl::PointXYZRGB());
+#pragma omp critical
+    {
+      min_pt = min_pt.min (local_min);
+      max_pt = max_pt.max (local_max);
+      sum += local_sum;
+      sq_sum += local_sq_sum;
+    }
+  }
 
- pcl::getMinMax3D (*cloud, min, max);
+  CloudStats stats;
+  stats.n_valid = static_cast<size_t> (sum (3));
+  stats.min = min_pt.head<3> ().matrix ();
+  stats.max = max_pt.head<3> ().matrix ();
+  stats.centroid.setZero ();
+  stats.covariance.setZero ();
 
-float x_min = min.x;
-float y_min = min.y;
-float z_min = min.z;
-float x_max = max.x;
-float y_max = max.y;
-float z_max = max.z;
+  if (stats.n_valid > 0)
+  {
+    Eigen::Vector3d mean = sum.head<3> () / sum (3);
+    Eigen::Matrix3d covariance = sq_sum.topLeftCorner<3, 3> () / sum (3) - mean * mean.transpose ();
+    stats.centroid = mean.cast<float> ();
+    stats.covariance = covariance.cast<float> ();
+  }
 
-minMax[0]=x_min;
-minMax[1]=y_min;
-minMax[2]=z_min;
-minMax[3]=x_max;
-minMax[4]=y_max;
-minMax[5]=z_max;
+  return stats;
 }
 
+void ModelProcessing::bounding_box (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, float (&minMax)[6]){
 
-Eigen::Vector3f ModelProcessing::computeCentroid(pcl::PointCloud<pcl::PointXYZRGB>::Ptr pcl_cloud) {
-    Eigen::Vector3f centroid;
-    centroid << 0, 0, 0;
+CloudStats stats = cloud_stats (cloud);
 
-    int size = pcl_cloud->width * pcl_cloud->height;
-    std::cout << "frame: " << pcl_cloud->header.frame_id << std::endl;
-    for (size_t i = 0; i != size; ++i) {
-        centroid += pcl_cloud->points[i].getVector3fMap();
-    }
-    if (size > 0) {
-        centroid /= ((float) size);
-    }
-    return centroid;
+minMax[0]=stats.min (0);
+minMax[1]=stats.min (1);
+minMax[2]=stats.min (2);
+minMax[3]=stats.max (0);
+minMax[4]=stats.max (1);
+minMax[5]=stats.max (2);
 }
 
 
-pcl::PointCloud<pcl::PointXYZRGB>::Ptr ModelProcessing::object_identification (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, int minPointRange, int maxPointRange)
-{
-  // Read in the cloud data
-  pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud_f (new pcl::PointCloud<pcl::PointXYZRGB>);
+Eigen::Vector3f ModelProcessing::computeCentroid(pcl::PointCloud<pcl::PointXYZRGB>::Ptr pcl_cloud) {
+    return cloud_stats (pcl_cloud).centroid;
+}
 
-  std::cout << "PointCloud before filtering has: " << cloud->points.size () << " data points." << std::endl; //*
 
+int ModelProcessing::peel_planes (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, pcl::IndicesPtr remaining)
+{
   // Create the segmentation object for the planar model and set all the parameters
   pcl::SACSegmentation<pcl::PointXYZRGB> seg;
   pcl::PointIndices::Ptr inliers (new pcl::PointIndices);
   pcl::ModelCoefficients::Ptr coefficients (new pcl::ModelCoefficients);
-  pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud_plane (new pcl::PointCloud<pcl::PointXYZRGB> ());
-  pcl::PCDWriter writer;
   seg.setOptimizeCoefficients (true);
   seg.setModelType (pcl::SACMODEL_PLANE);
   seg.setMethodType (pcl::SAC_RANSAC);
-  seg.setMaxIterations (100);
-  seg.setDistanceThreshold (0.02);
+  seg.setMaxIterations (ransac_iterations_);
+  seg.setDistanceThreshold (plane_distance_);
+  seg.setInputCloud (cloud);
+
+  // Marks the points that have been peeled off; the cloud itself is never touched
+  std::vector<char> removed (cloud->points.size (), 0);
 
-  int i=0, nr_points = (int) cloud->points.size ();
-  while (cloud->points.size () > 0.3 * nr_points)
+  int planes = 0;
+  size_t nr_points = remaining->size ();
+  while (remaining->size () > remaining_fraction_ * nr_points)
   {
-    // Segment the largest planar component from the remaining cloud
-    seg.setInputCloud (cloud);
+    // Segment the largest planar component from the remaining points
+    seg.setIndices (remaining);
     seg.segment (*inliers, *coefficients);
     if (inliers->indices.size () == 0)
-    {
-      std::cout << "Could not estimate a planar model for the given dataset." << std::endl;
       break;
-    }
-
-    // Extract the planar inliers from the input cloud
-    pcl::ExtractIndices<pcl::PointXYZRGB> extract;
-    extract.setInputCloud (cloud);
-    extract.setIndices (inliers);
-    extract.setNegative (false);
 
-    // Get the points associated with the planar surface
-    extract.filter (*cloud_plane);
-    std::cout << "PointCloud representing the planar component: " << cloud_plane->points.size () << " data points." << std::endl;
+    // Drop the planar inliers from the index set in place. The survivors keep
+    // their order, so RANSAC sees the same sequence the old copy-based loop did.
+    for (size_t i = 0; i < inliers->indices.size (); ++i)
+      removed[inliers->indices[i]] = 1;
 
-    // Remove the planar inliers, extract the rest
-    extract.setNegative (true);
-    extract.filter (*cloud_f);
-    *cloud = *cloud_f;
+    std::vector<int>::iterator out = remaining->begin ();
+    for (std::vector<int>::const_iterator it = remaining->begin (); it != remaining->end (); ++it)
+    {
+      if (!removed[*it])
+        *out++ = *it;
+    }
+    remaining->erase (out, remaining->end ());
+    planes++;
   }
 
-  // Creating the KdTree object for the search method of the extraction
-  pcl::search::KdTree<pcl::PointXYZRGB>::Ptr tree (new pcl::search::KdTree<pcl::PointXYZRGB>);
-  tree->setInputCloud (cloud);
+  return planes;
+}
+
+pcl::PointCloud<pcl::PointXYZRGB>::Ptr ModelProcessing::object_identification (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, int minPointRange, int maxPointRange)
+{
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr the_real_object (new pcl::PointCloud<pcl::PointXYZRGB>);
+  object_identification (cloud, minPointRange, maxPointRange, *the_real_object);
+  return the_real_object;
+}
+
+void ModelProcessing::object_identification (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, int minPointRange, int maxPointRange, pcl::PointCloud<pcl::PointXYZRGB> &the_real_object)
+{
+  // Planes are removed from an index set over the input cloud instead of copying
+  // what is left after every plane, so the caller's cloud is left as it was
+  pcl::IndicesPtr remaining (new std::vector<int> (cloud->points.size ()));
+  for (size_t i = 0; i < remaining->size (); ++i)
+    (*remaining)[i] = static_cast<int> (i);
+  peel_planes (cloud, remaining);
 
   std::vector<pcl::PointIndices> cluster_indices;
-  pcl::EuclideanClusterExtraction<pcl::PointXYZRGB> ec;
-  ec.setClusterTolerance (0.02); // 2cm
-  ec.setMinClusterSize (100);
-  ec.setMaxClusterSize (25000);
-  ec.setSearchMethod (tree);
-  ec.setInputCloud (cloud);
-  ec.extract (cluster_indices);
+  bool clustered = clustering_engine_ == VOXEL_HASH_CLUSTERING
+      && voxel_hash_clustering (*cloud, *remaining, cluster_tolerance_, min_cluster_size_, max_cluster_size_, cluster_indices);
+
+  if (!clustered)
+  {
+    // Creating the KdTree object for the search method of the extraction
+    pcl::search::KdTree<pcl::PointXYZRGB>::Ptr tree (new pcl::search::KdTree<pcl::PointXYZRGB>);
+    tree->setInputCloud (cloud, remaining);
+
+    pcl::EuclideanClusterExtraction<pcl::PointXYZRGB> ec;
+    ec.setClusterTolerance (cluster_tolerance_);
+    ec.setMinClusterSize (min_cluster_size_);
+    ec.setMaxClusterSize (max_cluster_size_);
+    ec.setSearchMethod (tree);
+    ec.setInputCloud (cloud);
+    ec.setIndices (remaining);
+    ec.extract (cluster_indices);
+  }
 
   int j = 0;
-  pcl::PointCloud<pcl::PointXYZRGB>::Ptr the_real_object (new pcl::PointCloud<pcl::PointXYZRGB>);
-  for (std::vector<pcl::PointIndices>::const_iterator it = cluster_indices.begin (); it != cluster_indices.end (); ++it)
+  const pcl::PointIndices *object_indices = NULL;
+  for (std::vector<pcl::PointIndices>::const_iterator it = cluster_indices.begin (); it != cluster_indices.end (); ++it, ++j)
   {
-    pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud_cluster (new pcl::PointCloud<pcl::PointXYZRGB>);
-    for (std::vector<int>::const_iterator pit = it->indices.begin (); pit != it->indices.end (); ++pit)
-      cloud_cluster->points.push_back (cloud->points[*pit]); //*
-    cloud_cluster->width = cloud_cluster->points.size ();
-    cloud_cluster->height = 1;
-    cloud_cluster->is_dense = true;
-
-    std::cout << "PointCloud representing the Cluster: " << cloud_cluster->points.size () << " data points." << std::endl;
-    std::stringstream ss;
-    ss << "cloud_cluster_" << j << ".pcd";
-    writer.write<pcl::PointXYZRGB> (ss.str (), *cloud_cluster, false); //*
-    j++;
-
-    if (cloud_cluster->points.size() < maxPointRange && cloud_cluster->points.size() > minPointRange){
-	the_real_object = cloud_cluster;
- 	}
-}
-  return the_real_object;
- 
+    if (it->indices.size () < maxPointRange && it->indices.size () > minPointRange)
+      object_indices = &*it;
+
+    if (debug_sink_)
+    {
+      pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud_cluster (new pcl::PointCloud<pcl::PointXYZRGB>);
+      pcl::copyPointCloud (*cloud, it->indices, *cloud_cluster);
+      cloud_cluster->is_dense = true;
+
+      std::stringstream ss;
+      ss << "cloud_cluster_" << j << ".pcd";
+      debug_sink_->post (debug_goal_, ss.str (), cloud_cluster);
+    }
+  }
+
+  // Only the object itself is copied out, into the caller's cloud
+  the_real_object.points.clear ();
+  if (object_indices != NULL)
+    pcl::copyPointCloud (*cloud, object_indices->indices, the_real_object);
+  the_real_object.width = the_real_object.points.size ();
+  the_real_object.height = 1;
+  the_real_object.is_dense = true;
 }
 
 std::string ModelProcessing::pcd_writer(pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, std::string filepath) {
@@ -209,13 +381,24 @@ for (int i = filepath.length() - 1; i >= 0; i--) {
      }
 }
 
-std::string fileName = Name + "_processed.pcd";
+return write_processed (cloud, Name);
 
-pcl::PCDWriter writer;
-writer.write<pcl::PointXYZRGB> (fileName, *cloud, false);
+}
+
+std::string ModelProcessing::write_processed (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, const std::string &name)
+{
+  std::string fileName = name + "_processed.pcd";
 
-return fileName;
+  // A missing directory makes the write below fail and report it
+  boost::filesystem::path parent = boost::filesystem::path (fileName).parent_path ();
+  boost::system::error_code ec;
+  if (!parent.empty ())
+    boost::filesystem::create_directories (parent, ec);
+
+  pcl::PCDWriter writer;
+  writer.write<pcl::PointXYZRGB> (fileName, *cloud, false);
 
+  return fileName;
 }
 
 
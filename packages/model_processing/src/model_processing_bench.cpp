@@ -0,0 +1,300 @@
+// Times every ModelProcessing method and the chain newPcdCB runs on a
+// synthetic tabletop scene. One JSON object per line is printed for each
+// benchmark, with throughput, latency percentiles and the process's peak RSS
+// so far. Before timing anything, the voxel hash clustering engine is checked
+// against pcl::EuclideanClusterExtraction on a set of scenes; the bench exits
+// with status 1 if the clusters differ.
+//
+// Usage: model_processing_bench [n_points] [noise] [clutter] [n_planes] [repeats]
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <pcl/io/pcd_io.h>
+#include <pcl/point_types.h>
+#include <pcl/search/kdtree.h>
+#include <pcl/segmentation/extract_clusters.h>
+#include <model_processing/model_processing.h>
+#include <model_processing/pipeline.h>
+#include <model_processing/voxel_hash_clustering.h>
+#include "synthetic_cloud.h"
+
+namespace
+{
+double now_ms ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+long peak_rss_kb ()
+{
+  struct rusage usage;
+  getrusage (RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+// Nearest-rank percentile of sorted samples
+double percentile (const std::vector<double> &sorted, double p)
+{
+  size_t rank = static_cast<size_t> (std::ceil (p / 100.0 * sorted.size ()));
+  return sorted[std::max<size_t> (rank, 1) - 1];
+}
+
+struct Context
+{
+  ModelProcessing model_processing;
+  Pipeline pipeline;
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr scene;
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr scratch;
+  std::string path;
+};
+
+// One iteration of a benchmark, returns the number of input points
+typedef size_t (*BenchFn) (Context &);
+
+size_t bench_pcd_reader (Context &ctx)
+{
+  return ctx.model_processing.pcd_reader (ctx.path)->points.size ();
+}
+
+size_t bench_downsampler (Context &ctx)
+{
+  ctx.model_processing.downsampler (ctx.scene, *ctx.scratch);
+  return ctx.scene->points.size ();
+}
+
+size_t bench_remove_outlier (Context &ctx)
+{
+  ctx.model_processing.remove_outlier (ctx.scene, *ctx.scratch);
+  return ctx.scene->points.size ();
+}
+
+size_t bench_bounding_box (Context &ctx)
+{
+  float minMax[6];
+  ctx.model_processing.bounding_box (ctx.scene, minMax);
+  return ctx.scene->points.size ();
+}
+
+size_t bench_compute_centroid (Context &ctx)
+{
+  ctx.model_processing.computeCentroid (ctx.scene);
+  return ctx.scene->points.size ();
+}
+
+size_t bench_cloud_stats (Context &ctx)
+{
+  ctx.model_processing.cloud_stats (ctx.scene);
+  return ctx.scene->points.size ();
+}
+
+size_t bench_peel_planes (Context &ctx)
+{
+  pcl::IndicesPtr remaining (new std::vector<int> (ctx.scene->points.size ()));
+  for (size_t i = 0; i < remaining->size (); ++i)
+    (*remaining)[i] = static_cast<int> (i);
+  ctx.model_processing.peel_planes (ctx.scene, remaining);
+  return ctx.scene->points.size ();
+}
+
+size_t bench_object_identification_kdtree (Context &ctx)
+{
+  ctx.model_processing.set_clustering_engine (KDTREE_CLUSTERING);
+  ctx.model_processing.object_identification (ctx.scene, 100, 25000, *ctx.scratch);
+  return ctx.scene->points.size ();
+}
+
+size_t bench_object_identification_voxel_hash (Context &ctx)
+{
+  ctx.model_processing.set_clustering_engine (VOXEL_HASH_CLUSTERING);
+  ctx.model_processing.object_identification (ctx.scene, 100, 25000, *ctx.scratch);
+  return ctx.scene->points.size ();
+}
+
+size_t bench_pcd_writer (Context &ctx)
+{
+  unlink (ctx.model_processing.pcd_writer (ctx.scene, ctx.path).c_str ());
+  return ctx.scene->points.size ();
+}
+
+// What newPcdCB does for every goal
+size_t bench_full_chain (Context &ctx)
+{
+  std::vector<StageTiming> timings;
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud = ctx.pipeline.model_processing ().pcd_reader (ctx.path);
+  size_t n = cloud->points.size ();
+  cloud = ctx.pipeline.run (cloud, timings);
+  ctx.pipeline.model_processing ().cloud_stats (cloud);
+  unlink (ctx.pipeline.model_processing ().pcd_writer (cloud, ctx.path).c_str ());
+  return n;
+}
+
+// Orders clusters by size, then by their smallest index, so clusters of equal
+// size compare the same whichever order an engine put them in
+bool cluster_less (const pcl::PointIndices &a, const pcl::PointIndices &b)
+{
+  if (a.indices.size () != b.indices.size ())
+    return a.indices.size () > b.indices.size ();
+  return a.indices < b.indices;
+}
+
+// Clusters the points peel_planes leaves of scene with both engines and
+// compares cluster count, sizes and membership
+bool check_clustering (ModelProcessing &model_processing, const pcl::PointCloud<pcl::PointXYZRGB>::Ptr &scene,
+                       const char *name, float tolerance, int min_size, int max_size)
+{
+  pcl::IndicesPtr remaining (new std::vector<int> (scene->points.size ()));
+  for (size_t i = 0; i < remaining->size (); ++i)
+    (*remaining)[i] = static_cast<int> (i);
+  model_processing.peel_planes (scene, remaining);
+
+  std::vector<pcl::PointIndices> expected;
+  pcl::search::KdTree<pcl::PointXYZRGB>::Ptr tree (new pcl::search::KdTree<pcl::PointXYZRGB>);
+  tree->setInputCloud (scene, remaining);
+  pcl::EuclideanClusterExtraction<pcl::PointXYZRGB> ec;
+  ec.setClusterTolerance (tolerance);
+  ec.setMinClusterSize (min_size);
+  ec.setMaxClusterSize (max_size);
+  ec.setSearchMethod (tree);
+  ec.setInputCloud (scene);
+  ec.setIndices (remaining);
+  ec.extract (expected);
+
+  std::vector<pcl::PointIndices> actual;
+  bool ran = voxel_hash_clustering (*scene, *remaining, tolerance, min_size, max_size, actual);
+
+  for (size_t i = 0; i < expected.size (); ++i)
+    std::sort (expected[i].indices.begin (), expected[i].indices.end ());
+  std::sort (expected.begin (), expected.end (), cluster_less);
+  std::sort (actual.begin (), actual.end (), cluster_less);
+
+  bool match = ran && actual.size () == expected.size ();
+  size_t first_difference = 0;
+  for (; match && first_difference < expected.size (); ++first_difference)
+    match = actual[first_difference].indices == expected[first_difference].indices;
+
+  printf ("{\"check\":\"voxel_hash_clustering\",\"scene\":\"%s\",\"points\":%zu,\"clustered\":%zu,"
+          "\"kdtree_clusters\":%zu,\"voxel_hash_clusters\":%zu,\"match\":%s}\n",
+          name, scene->points.size (), remaining->size (), expected.size (), actual.size (),
+          match ? "true" : "false");
+  if (!match && ran && actual.size () == expected.size ())
+    fprintf (stderr, "voxel_hash_clustering: cluster %zu differs on %s (%zu vs %zu points)\n", first_difference - 1,
+             name, actual[first_difference - 1].indices.size (), expected[first_difference - 1].indices.size ());
+  fflush (stdout);
+  return match;
+}
+
+// Tabletop scenes with few and with many clusters, clean and noisy
+bool check_clustering_engines (size_t n_points)
+{
+  struct Scene
+  {
+    const char *name;
+    int n_planes;
+    float noise;
+    float clutter;
+    unsigned int seed;
+  };
+  const Scene scenes[] = {
+    { "tabletop", 4, 0.002f, 0.05f, 1 },
+    { "noisy", 4, 0.01f, 0.05f, 2 },
+    { "clutter", 2, 0.002f, 0.3f, 3 },
+    { "no_planes", 0, 0.002f, 0.5f, 4 },
+  };
+
+  ModelProcessing model_processing;
+  bool ok = true;
+  for (size_t i = 0; i < sizeof (scenes) / sizeof (scenes[0]); ++i)
+  {
+    pcl::PointCloud<pcl::PointXYZRGB>::Ptr scene (new pcl::PointCloud<pcl::PointXYZRGB>);
+    synthetic::make_scene (*scene, n_points, scenes[i].n_planes, scenes[i].noise, scenes[i].clutter, scenes[i].seed);
+    // Small clusters too, so the clutter is compared and not just the box
+    ok = check_clustering (model_processing, scene, scenes[i].name, 0.02f, 1, 25000) && ok;
+    ok = check_clustering (model_processing, scene, scenes[i].name, 0.02f, 100, 25000) && ok;
+  }
+  return ok;
+}
+
+void run (const char *name, BenchFn fn, Context &ctx, int repeats, float noise, float clutter)
+{
+  // Untimed warm-up so page faults and first-touch allocations don't skew p99
+  fn (ctx);
+
+  std::vector<double> samples;
+  size_t points = 0;
+  for (int r = 0; r < repeats; ++r)
+  {
+    double start = now_ms ();
+    points = fn (ctx);
+    samples.push_back (now_ms () - start);
+  }
+  std::sort (samples.begin (), samples.end ());
+
+  double total = 0.0;
+  for (size_t i = 0; i < samples.size (); ++i)
+    total += samples[i];
+  double mean = total / samples.size ();
+
+  printf ("{\"benchmark\":\"%s\",\"points\":%zu,\"noise\":%g,\"clutter\":%g,\"repeats\":%d,"
+          "\"points_per_sec\":%.0f,\"mean_ms\":%.3f,\"p50_ms\":%.3f,\"p95_ms\":%.3f,\"p99_ms\":%.3f,"
+          "\"peak_rss_kb\":%ld}\n",
+          name, points, noise, clutter, repeats, mean > 0.0 ? points / (mean / 1e3) : 0.0, mean,
+          percentile (samples, 50), percentile (samples, 95), percentile (samples, 99), peak_rss_kb ());
+  fflush (stdout);
+}
+}
+
+int main (int argc, char **argv)
+{
+  size_t n_points = argc > 1 ? strtoul (argv[1], NULL, 10) : 300000;
+  float noise = argc > 2 ? atof (argv[2]) : 0.002f;
+  float clutter = argc > 3 ? atof (argv[3]) : 0.05f;
+  int n_planes = argc > 4 ? atoi (argv[4]) : 4;
+  int repeats = argc > 5 ? std::max (1, atoi (argv[5])) : 10;
+
+  if (!check_clustering_engines (std::min<size_t> (n_points, 100000)))
+    return 1;
+
+  Context ctx;
+  ctx.scene.reset (new pcl::PointCloud<pcl::PointXYZRGB>);
+  ctx.scratch.reset (new pcl::PointCloud<pcl::PointXYZRGB>);
+  synthetic::make_scene (*ctx.scene, n_points, n_planes, noise, clutter, 1);
+  ctx.pipeline.load_default ();
+
+  // The scene goes through a real file for pcd_reader and the full chain,
+  // pcd_writer's output lands in the working directory and is removed again
+  char path[] = "/tmp/model_processing_bench_XXXXXX.pcd";
+  int fd = mkstemps (path, 4);
+  if (fd < 0)
+  {
+    perror ("mkstemps");
+    return 1;
+  }
+  close (fd);
+  ctx.path = path;
+  pcl::PCDWriter writer;
+  writer.writeBinary (ctx.path, *ctx.scene);
+
+  run ("pcd_reader", bench_pcd_reader, ctx, repeats, noise, clutter);
+  run ("downsampler", bench_downsampler, ctx, repeats, noise, clutter);
+  run ("remove_outlier", bench_remove_outlier, ctx, repeats, noise, clutter);
+  run ("bounding_box", bench_bounding_box, ctx, repeats, noise, clutter);
+  run ("computeCentroid", bench_compute_centroid, ctx, repeats, noise, clutter);
+  run ("cloud_stats", bench_cloud_stats, ctx, repeats, noise, clutter);
+  run ("peel_planes", bench_peel_planes, ctx, repeats, noise, clutter);
+  run ("object_identification_kdtree", bench_object_identification_kdtree, ctx, repeats, noise, clutter);
+  run ("object_identification_voxel_hash", bench_object_identification_voxel_hash, ctx, repeats, noise, clutter);
+  run ("pcd_writer", bench_pcd_writer, ctx, repeats, noise, clutter);
+  run ("full_chain", bench_full_chain, ctx, repeats, noise, clutter);
+
+  unlink (path);
+  return 0;
+}
@@ -0,0 +1,332 @@
+#include <time.h>
+#include <sstream>
+#include <model_processing/pipeline.h>
+
+namespace
+{
+double monotonic_ms ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+// Reads an optional numeric entry, ints and doubles are both accepted
+bool read_number (XmlRpc::XmlRpcValue &entry, const std::string &key, double &value, std::string &error)
+{
+  if (!entry.hasMember (key))
+    return true;
+
+  XmlRpc::XmlRpcValue &v = entry[key];
+  if (v.getType () == XmlRpc::XmlRpcValue::TypeInt)
+    value = static_cast<int> (v);
+  else if (v.getType () == XmlRpc::XmlRpcValue::TypeDouble)
+    value = static_cast<double> (v);
+  else
+  {
+    error = "'" + key + "' is not a number";
+    return false;
+  }
+  return true;
+}
+
+class DownsampleStage : public PipelineStage
+{
+public:
+  explicit DownsampleStage (float leaf_size) : leaf_size_ (leaf_size) {}
+
+  std::string name () const { return "downsample"; }
+
+  std::string describe () const
+  {
+    std::ostringstream ss;
+    ss << name () << "(leaf_size=" << leaf_size_ << ")";
+    return ss.str ();
+  }
+
+  void process (ModelProcessing &model_processing, pcl::PointCloud<pcl::PointXYZRGB>::Ptr input,
+                pcl::PointCloud<pcl::PointXYZRGB> &output)
+  {
+    model_processing.downsampler (input, output, leaf_size_);
+  }
+
+private:
+  float leaf_size_;
+};
+
+class OutlierRemovalStage : public PipelineStage
+{
+public:
+  OutlierRemovalStage (int mean_k, double stddev_mult, int threads)
+    : mean_k_ (mean_k), stddev_mult_ (stddev_mult), threads_ (threads) {}
+
+  std::string name () const { return "outlier_removal"; }
+
+  std::string describe () const
+  {
+    std::ostringstream ss;
+    ss << name () << "(mean_k=" << mean_k_ << ",stddev_mult=" << stddev_mult_ << ",threads=" << threads_ << ")";
+    return ss.str ();
+  }
+
+  void process (ModelProcessing &model_processing, pcl::PointCloud<pcl::PointXYZRGB>::Ptr input,
+                pcl::PointCloud<pcl::PointXYZRGB> &output)
+  {
+    model_processing.remove_outlier (input, output, mean_k_, stddev_mult_, threads_);
+  }
+
+private:
+  int mean_k_;
+  double stddev_mult_;
+  int threads_;
+};
+
+class ObjectIdentificationStage : public PipelineStage
+{
+public:
+  ObjectIdentificationStage ()
+    : min_points_ (100), max_points_ (25000), ransac_iterations_ (100), plane_distance_ (0.02),
+      remaining_fraction_ (0.3), cluster_tolerance_ (0.02), min_cluster_size_ (100), max_cluster_size_ (25000),
+      engine_ (KDTREE_CLUSTERING) {}
+
+  std::string name () const { return "object_identification"; }
+
+  std::string describe () const
+  {
+    std::ostringstream ss;
+    ss << name () << "(min_points=" << min_points_ << ",max_points=" << max_points_
+       << ",ransac_iterations=" << ransac_iterations_ << ",plane_distance=" << plane_distance_
+       << ",remaining_fraction=" << remaining_fraction_ << ",cluster_tolerance=" << cluster_tolerance_
+       << ",min_cluster_size=" << min_cluster_size_ << ",max_cluster_size=" << max_cluster_size_
+       << ",clustering=" << (engine_ == VOXEL_HASH_CLUSTERING ? "voxel_hash" : "kdtree") << ")";
+    return ss.str ();
+  }
+
+  void process (ModelProcessing &model_processing, pcl::PointCloud<pcl::PointXYZRGB>::Ptr input,
+                pcl::PointCloud<pcl::PointXYZRGB> &output)
+  {
+    model_processing.set_plane_segmentation (ransac_iterations_, plane_distance_, remaining_fraction_);
+    model_processing.set_cluster_extraction (cluster_tolerance_, min_cluster_size_, max_cluster_size_);
+    model_processing.set_clustering_engine (engine_);
+    model_processing.object_identification (input, min_points_, max_points_, output);
+  }
+
+  int min_points_;
+  int max_points_;
+  int ransac_iterations_;
+  double plane_distance_;
+  double remaining_fraction_;
+  double cluster_tolerance_;
+  int min_cluster_size_;
+  int max_cluster_size_;
+  ClusteringEngine engine_;
+};
+
+boost::shared_ptr<PipelineStage> create_stage (XmlRpc::XmlRpcValue &entry, std::string &error)
+{
+  boost::shared_ptr<PipelineStage> stage;
+
+  if (entry.getType () != XmlRpc::XmlRpcValue::TypeStruct || !entry.hasMember ("stage")
+      || entry["stage"].getType () != XmlRpc::XmlRpcValue::TypeString)
+  {
+    error = "every entry needs a 'stage' name";
+    return stage;
+  }
+  std::string type = static_cast<std::string> (entry["stage"]);
+
+  if (type == "downsample")
+  {
+    double leaf_size = 0.001;
+    if (!read_number (entry, "leaf_size", leaf_size, error))
+      return stage;
+    // Also catches NaN, the voxel keys are computed from 1 / leaf_size
+    if (!(leaf_size > 0.0))
+    {
+      error = "'leaf_size' must be positive";
+      return stage;
+    }
+    stage.reset (new DownsampleStage (leaf_size));
+  }
+  else if (type == "outlier_removal")
+  {
+    double mean_k = 50, stddev_mult = 1.0, threads = 0;
+    if (!read_number (entry, "mean_k", mean_k, error) || !read_number (entry, "stddev_mult", stddev_mult, error)
+        || !read_number (entry, "threads", threads, error))
+      return stage;
+    if (!(mean_k >= 1.0))
+    {
+      error = "'mean_k' must be at least 1";
+      return stage;
+    }
+    // 0 means the worker's share of the cores
+    if (!(threads >= 0.0))
+    {
+      error = "'threads' must not be negative";
+      return stage;
+    }
+    stage.reset (new OutlierRemovalStage (static_cast<int> (mean_k), stddev_mult, static_cast<int> (threads)));
+  }
+  else if (type == "object_identification")
+  {
+    boost::shared_ptr<ObjectIdentificationStage> s (new ObjectIdentificationStage);
+    double min_points = s->min_points_, max_points = s->max_points_, ransac_iterations = s->ransac_iterations_;
+    double min_cluster_size = s->min_cluster_size_, max_cluster_size = s->max_cluster_size_;
+
+    if (!read_number (entry, "min_points", min_points, error) || !read_number (entry, "max_points", max_points, error)
+        || !read_number (entry, "ransac_iterations", ransac_iterations, error)
+        || !read_number (entry, "plane_distance", s->plane_distance_, error)
+        || !read_number (entry, "remaining_fraction", s->remaining_fraction_, error)
+        || !read_number (entry, "cluster_tolerance", s->cluster_tolerance_, error)
+        || !read_number (entry, "min_cluster_size", min_cluster_size, error)
+        || !read_number (entry, "max_cluster_size", max_cluster_size, error))
+      return stage;
+
+    if (!(ransac_iterations >= 1.0))
+    {
+      error = "'ransac_iterations' must be at least 1";
+      return stage;
+    }
+    if (!(s->plane_distance_ >= 0.0))
+    {
+      error = "'plane_distance' must not be negative";
+      return stage;
+    }
+    if (!(s->remaining_fraction_ >= 0.0 && s->remaining_fraction_ <= 1.0))
+    {
+      error = "'remaining_fraction' must be between 0 and 1";
+      return stage;
+    }
+    if (!(s->cluster_tolerance_ >= 0.0))
+    {
+      error = "'cluster_tolerance' must not be negative";
+      return stage;
+    }
+    if (!(min_cluster_size <= max_cluster_size))
+    {
+      error = "'min_cluster_size' must not be larger than 'max_cluster_size'";
+      return stage;
+    }
+
+    s->min_points_ = static_cast<int> (min_points);
+    s->max_points_ = static_cast<int> (max_points);
+    s->ransac_iterations_ = static_cast<int> (ransac_iterations);
+    s->min_cluster_size_ = static_cast<int> (min_cluster_size);
+    s->max_cluster_size_ = static_cast<int> (max_cluster_size);
+
+    if (entry.hasMember ("clustering"))
+    {
+      std::string clustering = entry["clustering"].getType () == XmlRpc::XmlRpcValue::TypeString
+          ? static_cast<std::string> (entry["clustering"]) : "";
+      if (clustering == "voxel_hash")
+        s->engine_ = VOXEL_HASH_CLUSTERING;
+      else if (clustering != "kdtree")
+      {
+        error = "'clustering' must be kdtree or voxel_hash";
+        return stage;
+      }
+    }
+    stage = s;
+  }
+  else
+  {
+    error = "unknown stage '" + type + "'";
+  }
+
+  return stage;
+}
+}
+
+Pipeline::Pipeline ()
+{
+  buffers_[0].reset (new pcl::PointCloud<pcl::PointXYZRGB>);
+  buffers_[1].reset (new pcl::PointCloud<pcl::PointXYZRGB>);
+}
+
+void Pipeline::load_default ()
+{
+  stages_.clear ();
+  add_stage (boost::shared_ptr<PipelineStage> (new DownsampleStage (0.001f)));
+  add_stage (boost::shared_ptr<PipelineStage> (new OutlierRemovalStage (50, 1.0, 0)));
+}
+
+bool Pipeline::load (XmlRpc::XmlRpcValue &config, std::string &error)
+{
+  if (config.getType () != XmlRpc::XmlRpcValue::TypeArray)
+  {
+    error = "pipeline must be a list of stages";
+    return false;
+  }
+
+  std::vector<boost::shared_ptr<PipelineStage> > stages;
+  for (int i = 0; i < config.size (); ++i)
+  {
+    boost::shared_ptr<PipelineStage> stage = create_stage (config[i], error);
+    if (!stage)
+    {
+      std::ostringstream ss;
+      ss << "stage " << i << ": " << error;
+      error = ss.str ();
+      return false;
+    }
+    stages.push_back (stage);
+  }
+
+  stages_.swap (stages);
+  return true;
+}
+
+bool Pipeline::load (const ros::NodeHandle &nh, const std::string &param, std::string &error)
+{
+  XmlRpc::XmlRpcValue config;
+  if (!nh.getParam (param, config))
+  {
+    error = "parameter " + param + " is not set";
+    return false;
+  }
+  return load (config, error);
+}
+
+void Pipeline::add_stage (boost::shared_ptr<PipelineStage> stage)
+{
+  stages_.push_back (stage);
+}
+
+std::string Pipeline::describe () const
+{
+  std::string description;
+  for (size_t i = 0; i < stages_.size (); ++i)
+  {
+    if (i > 0)
+      description += " -> ";
+    description += stages_[i]->describe ();
+  }
+  return description;
+}
+
+pcl::PointCloud<pcl::PointXYZRGB>::Ptr Pipeline::run (pcl::PointCloud<pcl::PointXYZRGB>::Ptr input,
+                                                      std::vector<StageTiming> &timings)
+{
+  timings.clear ();
+
+  // Stages alternate between the two buffers, each reading the one the
+  // previous stage wrote
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr current = input;
+  for (size_t i = 0; i < stages_.size (); ++i)
+  {
+    pcl::PointCloud<pcl::PointXYZRGB>::Ptr output = buffers_[i % 2];
+
+    double start = monotonic_ms ();
+    stages_[i]->process (model_processing_, current, *output);
+
+    StageTiming timing;
+    timing.name = stages_[i]->name ();
+    timing.milliseconds = monotonic_ms () - start;
+    timing.points_in = current->points.size ();
+    timing.points_out = output->points.size ();
+    timings.push_back (timing);
+
+    current = output;
+  }
+
+  return current;
+}
@@ -0,0 +1,99 @@
+// Times plane removal in ModelProcessing::object_identification on a multi-plane
+// scene: the index-based ModelProcessing::peel_planes against the previous loop
+// that extracted and deep-copied the remaining cloud after every plane.
+//
+// Usage: plane_peeling_bench [n_points] [n_planes] [repeats]
+
+#include <time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <pcl/io/pcd_io.h>
+#include <pcl/point_types.h>
+#include <pcl/ModelCoefficients.h>
+#include <pcl/filters/extract_indices.h>
+#include <pcl/sample_consensus/method_types.h>
+#include <pcl/sample_consensus/model_types.h>
+#include <pcl/segmentation/sac_segmentation.h>
+#include <model_processing/model_processing.h>
+#include "synthetic_cloud.h"
+
+static double now_ms ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+// The plane loop as object_identification used to run it
+static int copy_peel_planes (pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud)
+{
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud_f (new pcl::PointCloud<pcl::PointXYZRGB>);
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud_plane (new pcl::PointCloud<pcl::PointXYZRGB>);
+  pcl::SACSegmentation<pcl::PointXYZRGB> seg;
+  pcl::PointIndices::Ptr inliers (new pcl::PointIndices);
+  pcl::ModelCoefficients::Ptr coefficients (new pcl::ModelCoefficients);
+  seg.setOptimizeCoefficients (true);
+  seg.setModelType (pcl::SACMODEL_PLANE);
+  seg.setMethodType (pcl::SAC_RANSAC);
+  seg.setMaxIterations (100);
+  seg.setDistanceThreshold (0.02);
+
+  int planes = 0;
+  size_t nr_points = cloud->points.size ();
+  while (cloud->points.size () > 0.3 * nr_points)
+  {
+    seg.setInputCloud (cloud);
+    seg.segment (*inliers, *coefficients);
+    if (inliers->indices.size () == 0)
+      break;
+
+    pcl::ExtractIndices<pcl::PointXYZRGB> extract;
+    extract.setInputCloud (cloud);
+    extract.setIndices (inliers);
+    extract.setNegative (false);
+    extract.filter (*cloud_plane);
+    extract.setNegative (true);
+    extract.filter (*cloud_f);
+    *cloud = *cloud_f;
+    planes++;
+  }
+  return planes;
+}
+
+int main (int argc, char **argv)
+{
+  size_t n_points = argc > 1 ? strtoul (argv[1], NULL, 10) : 300000;
+  int n_planes = argc > 2 ? atoi (argv[2]) : 4;
+  int repeats = argc > 3 ? atoi (argv[3]) : 5;
+
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr scene (new pcl::PointCloud<pcl::PointXYZRGB>);
+  synthetic::make_scene (*scene, n_points, n_planes, 0.002f, 0.05f, 1);
+
+  ModelProcessing model_processing;
+  double index_ms = 0.0, copy_ms = 0.0;
+  int index_planes = 0, copy_planes = 0;
+
+  for (int r = 0; r < repeats; ++r)
+  {
+    pcl::IndicesPtr remaining (new std::vector<int> (scene->points.size ()));
+    for (size_t i = 0; i < remaining->size (); ++i)
+      (*remaining)[i] = static_cast<int> (i);
+
+    double start = now_ms ();
+    index_planes += model_processing.peel_planes (scene, remaining);
+    index_ms += now_ms () - start;
+
+    pcl::PointCloud<pcl::PointXYZRGB>::Ptr copy (new pcl::PointCloud<pcl::PointXYZRGB> (*scene));
+    start = now_ms ();
+    copy_planes += copy_peel_planes (copy);
+    copy_ms += now_ms () - start;
+  }
+
+  printf ("points %zu planes_in_scene %d repeats %d\n", scene->points.size (), n_planes, repeats);
+  printf ("%-16s %8s %12s %14s\n", "method", "planes", "total_ms", "ms_per_plane");
+  printf ("%-16s %8d %12.2f %14.3f\n", "index_peeling", index_planes, index_ms,
+          index_planes > 0 ? index_ms / index_planes : 0.0);
+  printf ("%-16s %8d %12.2f %14.3f\n", "copy_peeling", copy_planes, copy_ms,
+          copy_planes > 0 ? copy_ms / copy_planes : 0.0);
+  return 0;
+}
@@ -0,0 +1,101 @@
+#ifndef MODEL_PROCESSING_SYNTHETIC_CLOUD_H
+#define MODEL_PROCESSING_SYNTHETIC_CLOUD_H
+
+// Synthetic scenes for the model_processing benchmarks
+
+#include <stdlib.h>
+#include <algorithm>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+namespace synthetic
+{
+inline float uniform (unsigned int &seed, float lo, float hi)
+{
+  return lo + (hi - lo) * (rand_r (&seed) / static_cast<float> (RAND_MAX));
+}
+
+// Cheap bell-shaped jitter with standard deviation ~sigma
+inline float jitter (unsigned int &seed, float sigma)
+{
+  return sigma * (uniform (seed, -1.0f, 1.0f) + uniform (seed, -1.0f, 1.0f) + uniform (seed, -1.0f, 1.0f));
+}
+
+inline pcl::PointXYZRGB make_point (float x, float y, float z, unsigned char r, unsigned char g, unsigned char b)
+{
+  pcl::PointXYZRGB p (r, g, b);
+  p.x = x;
+  p.y = y;
+  p.z = z;
+  return p;
+}
+
+// Tabletop scene with n_points points: up to six large planes (table, walls,
+// ceiling), a 10 cm box on the table holding 5% of the points and a clutter
+// fraction of points scattered uniformly through the volume. noise is the
+// per-coordinate jitter in metres. The same seed gives the same cloud.
+inline void make_scene (pcl::PointCloud<pcl::PointXYZRGB> &cloud, size_t n_points, int n_planes,
+                        float noise, float clutter, unsigned int seed)
+{
+  n_planes = std::max (0, std::min (n_planes, 6));
+  clutter = std::max (0.0f, std::min (clutter, 0.9f));
+
+  size_t n_object = n_points / 20;
+  size_t n_clutter = static_cast<size_t> (clutter * n_points);
+  size_t n_plane = n_planes > 0 ? (n_points - n_object - n_clutter) / n_planes : 0;
+
+  cloud.points.clear ();
+  cloud.points.reserve (n_points);
+
+  for (int i = 0; i < n_planes; ++i)
+  {
+    for (size_t j = 0; j < n_plane; ++j)
+    {
+      float u = uniform (seed, -1.0f, 1.0f);
+      float v = uniform (seed, 0.0f, 1.5f);
+      float e = jitter (seed, noise);
+      switch (i)
+      {
+        case 0: cloud.points.push_back (make_point (u, uniform (seed, -1.0f, 1.0f), e, 120, 90, 60)); break;
+        case 1: cloud.points.push_back (make_point (-1.0f + e, u, v, 200, 200, 200)); break;
+        case 2: cloud.points.push_back (make_point (u, -1.0f + e, v, 190, 190, 200)); break;
+        case 3: cloud.points.push_back (make_point (1.0f + e, u, v, 200, 190, 190)); break;
+        case 4: cloud.points.push_back (make_point (u, 1.0f + e, v, 190, 200, 190)); break;
+        default: cloud.points.push_back (make_point (u, uniform (seed, -1.0f, 1.0f), 1.5f + e, 250, 250, 250)); break;
+      }
+    }
+  }
+
+  // Box resting on the table, points spread over its five visible faces
+  for (size_t j = 0; j < n_object; ++j)
+  {
+    float a = uniform (seed, -0.05f, 0.05f);
+    float b = uniform (seed, -0.05f, 0.05f);
+    float c = uniform (seed, 0.03f, 0.13f);
+    switch (j % 5)
+    {
+      case 0: cloud.points.push_back (make_point (a, b, 0.13f, 220, 30, 30)); break;
+      case 1: cloud.points.push_back (make_point (-0.05f, a, c, 220, 30, 30)); break;
+      case 2: cloud.points.push_back (make_point (0.05f, a, c, 220, 30, 30)); break;
+      case 3: cloud.points.push_back (make_point (a, -0.05f, c, 220, 30, 30)); break;
+      default: cloud.points.push_back (make_point (a, 0.05f, c, 220, 30, 30)); break;
+    }
+    pcl::PointXYZRGB &p = cloud.points.back ();
+    p.x += jitter (seed, noise);
+    p.y += jitter (seed, noise);
+    p.z += jitter (seed, noise);
+  }
+
+  while (cloud.points.size () < n_points)
+  {
+    cloud.points.push_back (make_point (uniform (seed, -1.0f, 1.0f), uniform (seed, -1.0f, 1.0f),
+                                        uniform (seed, 0.0f, 1.5f), 80, 80, 80));
+  }
+
+  cloud.width = static_cast<uint32_t> (cloud.points.size ());
+  cloud.height = 1;
+  cloud.is_dense = true;
+}
+}  // namespace synthetic
+
+#endif  // MODEL_PROCESSING_SYNTHETIC_CLOUD_H
@@ -0,0 +1,155 @@
+#include <stdint.h>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+#ifdef _OPENMP
+#include <parallel/algorithm>
+#endif
+#include <model_processing/voxel_downsample.h>
+
+namespace
+{
+const int KEY_BITS = 21;
+const int64_t KEY_RANGE = static_cast<int64_t> (1) << KEY_BITS;
+
+// z in the high bits so sorting by key gives pcl::VoxelGrid's voxel order
+inline uint64_t pack_key (int64_t x, int64_t y, int64_t z)
+{
+  return (static_cast<uint64_t> (z) << (2 * KEY_BITS)) | (static_cast<uint64_t> (y) << KEY_BITS) | static_cast<uint64_t> (x);
+}
+
+struct GridLess
+{
+  explicit GridLess (const std::vector<int64_t> &grid) : grid_ (grid) {}
+
+  bool operator() (int a, int b) const
+  {
+    const int64_t *ga = &grid_[3 * a], *gb = &grid_[3 * b];
+    if (ga[2] != gb[2])
+      return ga[2] < gb[2];
+    if (ga[1] != gb[1])
+      return ga[1] < gb[1];
+    return ga[0] < gb[0];
+  }
+
+  const std::vector<int64_t> &grid_;
+};
+
+template <typename Iterator, typename Compare>
+inline void sort_range (Iterator first, Iterator last, Compare comp)
+{
+#ifdef _OPENMP
+  __gnu_parallel::sort (first, last, comp);
+#else
+  std::sort (first, last, comp);
+#endif
+}
+}
+
+void voxel_downsample (const pcl::PointCloud<pcl::PointXYZRGB> &cloud, float leaf_size,
+                       pcl::PointCloud<pcl::PointXYZRGB> &output)
+{
+  const float inverse_leaf = 1.0f / leaf_size;
+
+  std::vector<int> slots;
+  slots.reserve (cloud.points.size ());
+  for (size_t i = 0; i < cloud.points.size (); ++i)
+  {
+    const pcl::PointXYZRGB &p = cloud.points[i];
+    if (pcl_isfinite (p.x) && pcl_isfinite (p.y) && pcl_isfinite (p.z))
+      slots.push_back (static_cast<int> (i));
+  }
+  const int nr_points = static_cast<int> (slots.size ());
+
+  std::vector<int64_t> grid (3 * nr_points);
+  int64_t min_x = KEY_RANGE, min_y = KEY_RANGE, min_z = KEY_RANGE;
+  int64_t max_x = -KEY_RANGE, max_y = -KEY_RANGE, max_z = -KEY_RANGE;
+
+#pragma omp parallel for reduction (min: min_x, min_y, min_z) reduction (max: max_x, max_y, max_z)
+  for (int i = 0; i < nr_points; ++i)
+  {
+    const pcl::PointXYZRGB &p = cloud.points[slots[i]];
+    int64_t *g = &grid[3 * i];
+    g[0] = static_cast<int64_t> (std::floor (p.x * inverse_leaf));
+    g[1] = static_cast<int64_t> (std::floor (p.y * inverse_leaf));
+    g[2] = static_cast<int64_t> (std::floor (p.z * inverse_leaf));
+    min_x = std::min (min_x, g[0]);
+    min_y = std::min (min_y, g[1]);
+    min_z = std::min (min_z, g[2]);
+    max_x = std::max (max_x, g[0]);
+    max_y = std::max (max_y, g[1]);
+    max_z = std::max (max_z, g[2]);
+  }
+
+  // Points are sorted by (voxel key, point index), so each voxel becomes a
+  // contiguous run and its points are summed in index order like VoxelGrid does
+  std::vector<std::pair<uint64_t, int> > keyed (nr_points);
+  if (nr_points == 0 || (max_x - min_x < KEY_RANGE && max_y - min_y < KEY_RANGE && max_z - min_z < KEY_RANGE))
+  {
+#pragma omp parallel for
+    for (int i = 0; i < nr_points; ++i)
+    {
+      const int64_t *g = &grid[3 * i];
+      keyed[i] = std::make_pair (pack_key (g[0] - min_x, g[1] - min_y, g[2] - min_z), i);
+    }
+  }
+  else
+  {
+    // Too wide to pack into 64 bits (2 km at 1 mm), number the voxels instead
+    std::vector<int> order (nr_points);
+    for (int i = 0; i < nr_points; ++i)
+      order[i] = i;
+    GridLess less (grid);
+    sort_range (order.begin (), order.end (), less);
+
+    uint64_t rank = 0;
+    for (int i = 0; i < nr_points; ++i)
+    {
+      if (i > 0 && less (order[i - 1], order[i]))
+        rank++;
+      keyed[order[i]] = std::make_pair (rank, order[i]);
+    }
+  }
+  sort_range (keyed.begin (), keyed.end (), std::less<std::pair<uint64_t, int> > ());
+
+  std::vector<int> voxel_begin;
+  for (int i = 0; i < nr_points; ++i)
+    if (i == 0 || keyed[i].first != keyed[i - 1].first)
+      voxel_begin.push_back (i);
+  const int nr_voxels = static_cast<int> (voxel_begin.size ());
+  voxel_begin.push_back (nr_points);
+
+  output.header = cloud.header;
+  output.points.resize (nr_voxels);
+  output.width = nr_voxels;
+  output.height = 1;
+  output.is_dense = true;
+
+#pragma omp parallel for
+  for (int v = 0; v < nr_voxels; ++v)
+  {
+    float x = 0, y = 0, z = 0, r = 0, g = 0, b = 0;
+    for (int i = voxel_begin[v]; i < voxel_begin[v + 1]; ++i)
+    {
+      const pcl::PointXYZRGB &p = cloud.points[slots[keyed[i].second]];
+      x += p.x;
+      y += p.y;
+      z += p.z;
+      r += p.r;
+      g += p.g;
+      b += p.b;
+    }
+
+    const float n = static_cast<float> (voxel_begin[v + 1] - voxel_begin[v]);
+    pcl::PointXYZRGB &q = output.points[v];
+    q = cloud.points[slots[keyed[voxel_begin[v]].second]];
+    q.x = x / n;
+    q.y = y / n;
+    q.z = z / n;
+    q.r = static_cast<uint8_t> (r / n);
+    q.g = static_cast<uint8_t> (g / n);
+    q.b = static_cast<uint8_t> (b / n);
+  }
+}
@@ -0,0 +1,254 @@
+#include <stdint.h>
+#include <cmath>
+#include <algorithm>
+#include <utility>
+#include <boost/unordered_map.hpp>
+#ifdef _OPENMP
+#include <parallel/algorithm>
+#endif
+#include <pcl/segmentation/extract_clusters.h>
+#include <model_processing/voxel_hash_clustering.h>
+
+namespace
+{
+const int KEY_BITS = 21;
+const int64_t KEY_RANGE = static_cast<int64_t> (1) << KEY_BITS;
+
+inline uint64_t pack_key (int64_t x, int64_t y, int64_t z)
+{
+  return (static_cast<uint64_t> (x) << (2 * KEY_BITS)) | (static_cast<uint64_t> (y) << KEY_BITS) | static_cast<uint64_t> (z);
+}
+
+// Lock-free union-find: roots are only ever linked below a smaller root with a
+// CAS, and finds halve paths with a CAS that can only shortcut to an ancestor.
+inline int find_root (int *parent, int x)
+{
+  for (;;)
+  {
+    int p = __atomic_load_n (&parent[x], __ATOMIC_ACQUIRE);
+    if (p == x)
+      return x;
+    int gp = __atomic_load_n (&parent[p], __ATOMIC_ACQUIRE);
+    if (gp != p)
+      __sync_bool_compare_and_swap (&parent[x], p, gp);
+    x = gp;
+  }
+}
+
+inline void unite (int *parent, int a, int b)
+{
+  for (;;)
+  {
+    a = find_root (parent, a);
+    b = find_root (parent, b);
+    if (a == b)
+      return;
+    if (a < b)
+      std::swap (a, b);
+    if (__sync_bool_compare_and_swap (&parent[a], a, b))
+      return;
+  }
+}
+
+struct Component
+{
+  int first;
+  int size;
+  int label;
+};
+
+inline bool by_first_index (const Component &a, const Component &b)
+{
+  return a.first < b.first;
+}
+}
+
+bool voxel_hash_clustering (const pcl::PointCloud<pcl::PointXYZRGB> &cloud, const std::vector<int> &indices,
+                            float tolerance, int min_size, int max_size,
+                            std::vector<pcl::PointIndices> &clusters)
+{
+  // Cells are tolerance / sqrt(3) wide rather than tolerance wide: any two points
+  // in one cell are then closer than tolerance, so a cell is always a single
+  // component and neighbouring cells only need one close pair to be merged.
+  // The price is searching two cells out instead of one.
+  const double cell_size = tolerance / std::sqrt (3.0);
+  const float sq_tolerance = tolerance * tolerance;
+
+  std::vector<int> slots;
+  slots.reserve (indices.size ());
+  for (size_t i = 0; i < indices.size (); ++i)
+  {
+    const pcl::PointXYZRGB &p = cloud.points[indices[i]];
+    if (pcl_isfinite (p.x) && pcl_isfinite (p.y) && pcl_isfinite (p.z))
+      slots.push_back (indices[i]);
+  }
+  const int nr_points = static_cast<int> (slots.size ());
+
+  std::vector<int64_t> grid (3 * nr_points);
+  int64_t min_x = KEY_RANGE, min_y = KEY_RANGE, min_z = KEY_RANGE;
+  int64_t max_x = -KEY_RANGE, max_y = -KEY_RANGE, max_z = -KEY_RANGE;
+
+#pragma omp parallel for reduction (min: min_x, min_y, min_z) reduction (max: max_x, max_y, max_z)
+  for (int i = 0; i < nr_points; ++i)
+  {
+    const pcl::PointXYZRGB &p = cloud.points[slots[i]];
+    int64_t *g = &grid[3 * i];
+    g[0] = static_cast<int64_t> (std::floor (p.x / cell_size));
+    g[1] = static_cast<int64_t> (std::floor (p.y / cell_size));
+    g[2] = static_cast<int64_t> (std::floor (p.z / cell_size));
+    min_x = std::min (min_x, g[0]);
+    min_y = std::min (min_y, g[1]);
+    min_z = std::min (min_z, g[2]);
+    max_x = std::max (max_x, g[0]);
+    max_y = std::max (max_y, g[1]);
+    max_z = std::max (max_z, g[2]);
+  }
+
+  if (nr_points > 0 && (max_x - min_x >= KEY_RANGE || max_y - min_y >= KEY_RANGE || max_z - min_z >= KEY_RANGE))
+    return false;
+
+  // Sort the points by cell so every cell is a contiguous run
+  std::vector<std::pair<uint64_t, int> > keyed (nr_points);
+#pragma omp parallel for
+  for (int i = 0; i < nr_points; ++i)
+  {
+    const int64_t *g = &grid[3 * i];
+    keyed[i] = std::make_pair (pack_key (g[0] - min_x, g[1] - min_y, g[2] - min_z), i);
+  }
+#ifdef _OPENMP
+  __gnu_parallel::sort (keyed.begin (), keyed.end ());
+#else
+  std::sort (keyed.begin (), keyed.end ());
+#endif
+
+  std::vector<Eigen::Vector3f> points (nr_points);
+  std::vector<int> cell_begin;
+  std::vector<uint64_t> cell_key;
+  boost::unordered_map<uint64_t, int> cell_of_key;
+  cell_of_key.reserve (nr_points / 4 + 1);
+
+  for (int i = 0; i < nr_points; ++i)
+  {
+    points[i] = cloud.points[slots[keyed[i].second]].getVector3fMap ();
+    if (i == 0 || keyed[i].first != keyed[i - 1].first)
+    {
+      cell_of_key[keyed[i].first] = static_cast<int> (cell_begin.size ());
+      cell_begin.push_back (i);
+      cell_key.push_back (keyed[i].first);
+    }
+  }
+  const int nr_cells = static_cast<int> (cell_begin.size ());
+  cell_begin.push_back (nr_points);
+
+  // Forward half of the neighbour cells that can hold a point within tolerance,
+  // so each pair of cells is looked at once
+  std::vector<int> offsets;
+  for (int dx = -2; dx <= 2; ++dx)
+    for (int dy = -2; dy <= 2; ++dy)
+      for (int dz = -2; dz <= 2; ++dz)
+      {
+        if (dx < 0 || (dx == 0 && (dy < 0 || (dy == 0 && dz <= 0))))
+          continue;
+        int gap = (std::abs (dx) > 1) + (std::abs (dy) > 1) + (std::abs (dz) > 1);
+        if (gap == 3)
+          continue;
+        offsets.push_back (dx);
+        offsets.push_back (dy);
+        offsets.push_back (dz);
+      }
+
+  // Every cell starts out as one component rooted at its first point
+  std::vector<int> parent (nr_points);
+  for (int c = 0; c < nr_cells; ++c)
+    for (int i = cell_begin[c]; i < cell_begin[c + 1]; ++i)
+      parent[i] = cell_begin[c];
+
+  const uint64_t mask = KEY_RANGE - 1;
+#pragma omp parallel for schedule (dynamic, 64)
+  for (int c = 0; c < nr_cells; ++c)
+  {
+    int64_t x = cell_key[c] >> (2 * KEY_BITS);
+    int64_t y = (cell_key[c] >> KEY_BITS) & mask;
+    int64_t z = cell_key[c] & mask;
+
+    for (size_t k = 0; k < offsets.size (); k += 3)
+    {
+      int64_t nx = x + offsets[k], ny = y + offsets[k + 1], nz = z + offsets[k + 2];
+      if (ny < 0 || nz < 0 || nx >= KEY_RANGE || ny >= KEY_RANGE || nz >= KEY_RANGE)
+        continue;
+
+      boost::unordered_map<uint64_t, int>::const_iterator it = cell_of_key.find (pack_key (nx, ny, nz));
+      if (it == cell_of_key.end ())
+        continue;
+      int d = it->second;
+
+      if (find_root (&parent[0], cell_begin[c]) == find_root (&parent[0], cell_begin[d]))
+        continue;
+
+      bool linked = false;
+      for (int p = cell_begin[c]; p < cell_begin[c + 1] && !linked; ++p)
+        for (int q = cell_begin[d]; q < cell_begin[d + 1]; ++q)
+        {
+          if ((points[p] - points[q]).squaredNorm () < sq_tolerance)
+          {
+            unite (&parent[0], cell_begin[c], cell_begin[d]);
+            linked = true;
+            break;
+          }
+        }
+    }
+  }
+
+  // Collect the components, ordered by their lowest point index like pcl's seeds
+  std::vector<int> label (nr_points);
+  std::vector<Component> components;
+  std::vector<int> component_of_root (nr_points, -1);
+  for (int i = 0; i < nr_points; ++i)
+  {
+    int root = find_root (&parent[0], i);
+    if (component_of_root[root] < 0)
+    {
+      Component component = { slots[keyed[i].second], 0, 0 };
+      component_of_root[root] = static_cast<int> (components.size ());
+      components.push_back (component);
+    }
+    Component &component = components[component_of_root[root]];
+    component.first = std::min (component.first, slots[keyed[i].second]);
+    component.size++;
+    label[i] = component_of_root[root];
+  }
+
+  std::vector<Component> kept;
+  for (size_t i = 0; i < components.size (); ++i)
+  {
+    if (components[i].size >= min_size && components[i].size <= max_size)
+    {
+      components[i].label = static_cast<int> (i);
+      kept.push_back (components[i]);
+    }
+  }
+  std::sort (kept.begin (), kept.end (), by_first_index);
+
+  std::vector<int> cluster_of_component (components.size (), -1);
+  clusters.clear ();
+  clusters.resize (kept.size ());
+  for (size_t i = 0; i < kept.size (); ++i)
+  {
+    cluster_of_component[kept[i].label] = static_cast<int> (i);
+    clusters[i].header = cloud.header;
+    clusters[i].indices.reserve (kept[i].size);
+  }
+
+  for (int i = 0; i < nr_points; ++i)
+  {
+    int cluster = cluster_of_component[label[i]];
+    if (cluster >= 0)
+      clusters[cluster].indices.push_back (slots[keyed[i].second]);
+  }
+
+  for (size_t i = 0; i < clusters.size (); ++i)
+    std::sort (clusters[i].indices.begin (), clusters[i].indices.end ());
+  std::sort (clusters.rbegin (), clusters.rend (), pcl::comparePointClusters);
+
+  return true;
+}
@@ -30,9 +30,15 @@
 #define _INOTIFYCXX_H_
 
 #include <stdint.h>
+#include <signal.h>
+#include <limits.h>
+#include <string.h>
 #include <string>
 #include <deque>
 #include <map>
+#include <set>
+#include <vector>
+#include <tr1/unordered_map>
 
 // Please ensure that the following header file takes the right place
 #include <sys/inotify.h>
@@ -44,6 +50,12 @@
 /// Event buffer length
 #define INOTIFY_BUFLEN (1024 * (INOTIFY_EVENT_SIZE + 16))
 
+/// Event queue capacity (must be a power of 2)
+#define INOTIFY_QUEUE_SIZE 1024
+
+/// Cache line size used to keep the queue positions apart
+#define INOTIFY_CACHE_LINE 64
+
 /// Helper macro for creating exception messages.
 /**
  * It prepends the message by the function name.
@@ -212,6 +224,9 @@ protected:
  * It holds all information about inotify event and provides
  * access to its particular values.
  * 
+ * The name is stored inline (a file name is at most NAME_MAX
+ * bytes) so events can be copied without heap allocation.
+ * 
  * This class is not (and is not intended to be) thread-safe
  * and therefore it must not be used concurrently in multiple
  * threads.
@@ -225,8 +240,10 @@ public:
    */
   InotifyEvent()
   : m_uMask(0),
-    m_uCookie(0)
+    m_uCookie(0),
+    m_uLen(0)
   {
+    m_name[0] = '\0';
     m_pWatch = NULL;
   }
   
@@ -240,15 +257,18 @@ public:
    */
   InotifyEvent(const struct inotify_event* pEvt, InotifyWatch* pWatch)
   : m_uMask(0),
-    m_uCookie(0)
+    m_uCookie(0),
+    m_uLen(0)
   {
+    m_name[0] = '\0';
     if (pEvt != NULL) {
       m_uMask = (uint32_t) pEvt->mask;
       m_uCookie = (uint32_t) pEvt->cookie;
-      if (pEvt->name != NULL) {
-        m_name = pEvt->len > 0
-            ? pEvt->name
-            : "";
+      if (pEvt->len > 0) {
+        // the kernel pads the name with zeros up to len
+        m_uLen = (uint32_t) strnlen(pEvt->name, pEvt->len < NAME_MAX ? pEvt->len : NAME_MAX);
+        memcpy(m_name, pEvt->name, m_uLen);
+        m_name[m_uLen] = '\0';
       }
       m_pWatch = pWatch;
     }
@@ -257,6 +277,34 @@ public:
     }
   }
   
+  /// Copy constructor.
+  /**
+   * Only the used part of the name is copied.
+   * 
+   * \param[in] rEvt source event
+   */
+  InotifyEvent(const InotifyEvent& rEvt)
+  {
+    *this = rEvt;
+  }
+  
+  /// Assignment operator.
+  /**
+   * Only the used part of the name is copied.
+   * 
+   * \param[in] rEvt source event
+   * \return this event
+   */
+  InotifyEvent& operator=(const InotifyEvent& rEvt)
+  {
+    m_uMask = rEvt.m_uMask;
+    m_uCookie = rEvt.m_uCookie;
+    m_uLen = rEvt.m_uLen;
+    memcpy(m_name, rEvt.m_name, rEvt.m_uLen + 1);
+    m_pWatch = rEvt.m_pWatch;
+    return *this;
+  }
+  
   /// Destructor.
   ~InotifyEvent() {}
   
@@ -315,16 +363,16 @@ public:
    */
   inline uint32_t GetLength() const
   {
-    return (uint32_t) m_name.length();
+    return m_uLen;
   }
   
   /// Returns the event name.
   /**
    * \return event name
    */
-  inline const std::string& GetName() const
+  inline std::string GetName() const
   {
-    return m_name;
+    return std::string(m_name, m_uLen);
   }
   
   /// Extracts the event name.
@@ -333,12 +381,31 @@ public:
    */
   inline void GetName(std::string& rName) const
   {
-    rName = GetName();
+    rName.assign(m_name, m_uLen);
+  }
+  
+  /// Extracts the full path of the event subject.
+  /**
+   * The path is the path of the source watch (for recursive
+   * watches the subdirectory where the event occurred) followed
+   * by the event name, if any.
+   * 
+   * \param[out] rPath event path
+   */
+  void GetPath(std::string& rPath) const;
+  
+  /// Returns the event name without copying it.
+  /**
+   * \return zero-terminated event name, valid as long as the event
+   */
+  inline const char* GetNameCStr() const
+  {
+    return m_name;
   }
   
   /// Returns the source watch.
   /**
-   * \return source watch
+   * \return source watch; NULL for IN_Q_OVERFLOW
    */
   inline InotifyWatch* GetWatch()
   {
@@ -368,8 +435,11 @@ public:
 private:
   uint32_t m_uMask;           ///< mask
   uint32_t m_uCookie;         ///< cookie
-  std::string m_name;         ///< name
+  uint32_t m_uLen;            ///< name length
+  char m_name[NAME_MAX + 1];  ///< name (zero-terminated)
   InotifyWatch* m_pWatch;     ///< source watch
+  
+  friend class Inotify;
 };
 
 
@@ -392,21 +462,25 @@ public:
    * \param[in] rPath watched file path
    * \param[in] uMask mask for events
    * \param[in] fEnabled events enabled yes/no
+   * \param[in] fRecursive watch subdirectories too (see IsRecursive())
    */
-  InotifyWatch(const std::string& rPath, int32_t uMask, bool fEnabled = true)
+  InotifyWatch(const std::string& rPath, int32_t uMask, bool fEnabled = true, bool fRecursive = false)
   : m_path(rPath),
     m_uMask(uMask),
     m_wd((int32_t) -1),
-    m_fEnabled(fEnabled)
+    m_pInotify(NULL),
+    m_fEnabled(fEnabled),
+    m_fRecursive(fRecursive),
+    m_pRoot(NULL)
   {
     IN_LOCK_INIT
   }
   
   /// Destructor.
-  ~InotifyWatch()
-  {
-    IN_LOCK_DONE
-  }
+  /**
+   * Destroys also the subdirectory watches of a recursive watch.
+   */
+  ~InotifyWatch();
   
   /// Returns the watch descriptor.
   /**
@@ -485,13 +559,26 @@ public:
    * its subdirectories. This watch is a logical object
    * which may have many underlying kernel watches.
    * 
-   * \return currently always false (recursive watches not yet supported)
-   * \attention Recursive watches are currently NOT supported.
-   *            They are planned for future versions.
+   * The subdirectory watches are created and owned by the
+   * Inotify object. They are added when a directory is created
+   * or moved into the tree and dropped when it is moved out or
+   * deleted. Events from a subdirectory carry its watch, so
+   * InotifyEvent::GetPath() gives the full path. Events only
+   * needed to track the tree (IN_CREATE, IN_MOVED_FROM,
+   * IN_MOVED_TO) are reported only if they are in the mask.
+   * 
+   * Files created in a new directory before its watch is added
+   * produce no events. Users interested in them should watch
+   * for IN_CREATE and scan the directory on IN_CREATE|IN_ISDIR,
+   * which is queued after the watch has been added.
+   * 
+   * Mask changes and enabling/disabling apply to the whole tree.
+   * 
+   * \return true = recursive, false = otherwise
    */
   inline bool IsRecursive() const
   {
-    return false;    
+    return m_fRecursive;
   }
   
 private:
@@ -502,9 +589,27 @@ private:
   int32_t m_wd;         ///< watch descriptor
   Inotify* m_pInotify;  ///< inotify object
   bool m_fEnabled;      ///< events enabled yes/no
+  bool m_fRecursive;    ///< subdirectories watched yes/no
+  InotifyWatch* m_pRoot;                ///< recursive watch this subdirectory belongs to
+  std::vector<InotifyWatch*> m_children;  ///< subdirectory watches (root only)
+  std::vector<InotifyWatch*> m_retired;   ///< gone subdirectory watches (root only)
   
   IN_LOCK_DECL
   
+  /// Returns the mask set in the kernel.
+  /**
+   * Recursive watches additionally need the events tracking
+   * subdirectories.
+   * 
+   * \return kernel event mask
+   */
+  inline uint32_t GetKernelMask() const
+  {
+    return m_fRecursive
+        ?   m_uMask | IN_CREATE | IN_MOVED_FROM | IN_MOVED_TO
+        :   m_uMask;
+  }
+  
   /// Disables the watch (due to removing by the kernel).
   /**
    * This method must be called after receiving an event.
@@ -516,10 +621,24 @@ private:
 
 
 /// Mapping from watch descriptors to watch objects.
-typedef std::map<int32_t, InotifyWatch*> IN_WATCH_MAP;
+/**
+ * Hashed because every event is looked up here and recursive
+ * watches may have thousands of entries.
+ */
+typedef std::tr1::unordered_map<int32_t, InotifyWatch*> IN_WATCH_MAP;
 
 /// Mapping from paths to watch objects.
-typedef std::map<std::string, InotifyWatch*> IN_WP_MAP;
+typedef std::tr1::unordered_map<std::string, InotifyWatch*> IN_WP_MAP;
+
+
+/// What woke up Inotify::WaitForActivity().
+struct InotifyActivity
+{
+  bool fShutdown;               ///< Inotify::Shutdown() has been called
+  bool fEvents;                 ///< new events have been queued
+  std::vector<int> timers;      ///< expired timers
+  std::vector<int> descriptors; ///< readable descriptors added with AddDescriptor()
+};
 
 
 /// inotify class
@@ -527,6 +646,20 @@ typedef std::map<std::string, InotifyWatch*> IN_WP_MAP;
  * It holds information about the inotify device descriptor
  * and manages the event queue.
  * 
+ * The event queue is a lock-free ring of INOTIFY_QUEUE_SIZE
+ * preallocated events with a single producer (the thread calling
+ * WaitForEvents() or WaitForActivity()) and any number of consumers
+ * (threads calling GetEvent()). When the ring is full further events
+ * are dropped and a single IN_Q_OVERFLOW event follows the last
+ * event queued before the drop, as the kernel does for its own queue.
+ * It is queued by the next event that finds room again, or handed out
+ * by GetEvent() once the ring has been drained, whichever comes first.
+ * 
+ * Watches of subdirectories that disappear from a recursive watch
+ * stay allocated while queued events may point to them. They are
+ * freed by the first WaitForEvents() that finds the queue empty, so
+ * events of such watches must not be kept past that call.
+ * 
  * If the INOTIFY_THREAD_SAFE is defined this class is thread-safe.
  */
 class Inotify
@@ -552,6 +685,10 @@ public:
     
   /// Adds a new watch.
   /**
+   * For a recursive watch all existing subdirectories are
+   * watched too. Subdirectories that cannot be watched (e.g.
+   * because they vanish meanwhile) are skipped.
+   * 
    * \param[in] pWatch inotify watch
    * 
    * \throw InotifyException thrown if adding failed
@@ -572,6 +709,8 @@ public:
   /// Removes a watch.
   /**
    * If the given watch is not present it does nothing.
+   * The subdirectory watches of a recursive watch are
+   * removed and destroyed.
    * 
    * \param[in] pWatch inotify watch
    * 
@@ -598,7 +737,7 @@ public:
   /// Returns the count of watches.
   /**
    * This is the total count of all watches (regardless whether
-   * enabled or not).
+   * enabled or not) including subdirectory watches.
    * 
    * \return count of watches
    * 
@@ -632,6 +771,8 @@ public:
    * in nonblocking mode it only retrieves occurred events
    * to the internal queue and exits.
    * 
+   * Only one thread at a time may read events.
+   * 
    * \param[in] fNoIntr if true it re-calls the system call after a handled signal
    * 
    * \throw InotifyException thrown if reading events failed
@@ -640,19 +781,106 @@ public:
    */
   void WaitForEvents(bool fNoIntr = false) throw (InotifyException);
   
+  /// Waits for inotify events, timers, other descriptors or shutdown.
+  /**
+   * It waits (using epoll) until at least one of the following
+   * happens or the timeout expires: inotify events arrive (they are
+   * read to the internal queue as by WaitForEvents()), a timer
+   * created by AddTimer() expires, a descriptor added by
+   * AddDescriptor() becomes readable, or Shutdown() is called.
+   * A signal interrupting the wait makes it return early with only
+   * fShutdown possibly set.
+   * 
+   * This is meant to be driven from a single thread, only Shutdown()
+   * may be called concurrently.
+   * 
+   * \param[out] rAct what happened
+   * \param[in] iTimeoutMs timeout in milliseconds, -1 waits forever
+   * 
+   * \throw InotifyException thrown if waiting or reading events failed
+   * 
+   * \sa Shutdown(), AddTimer(), AddDescriptor()
+   */
+  void WaitForActivity(InotifyActivity& rAct, int iTimeoutMs = -1) throw (InotifyException);
+  
+  /// Wakes up WaitForActivity() for good.
+  /**
+   * Every current and future WaitForActivity() call returns
+   * immediately with fShutdown set. Only async-signal-safe calls
+   * are made so this may be called from a signal handler.
+   */
+  void Shutdown();
+  
+  /// Checks whether Shutdown() has been called.
+  /**
+   * \return true after Shutdown(), false otherwise
+   */
+  inline bool IsShutdown() const
+  {
+    return m_shutdown != 0;
+  }
+  
+  /// Creates a timer reported by WaitForActivity().
+  /**
+   * The timer is created disarmed, use SetTimer() to start it.
+   * 
+   * \return timer identifier
+   * 
+   * \throw InotifyException thrown if the timer cannot be created
+   */
+  int AddTimer() throw (InotifyException);
+  
+  /// Arms or disarms a timer.
+  /**
+   * \param[in] iTimer timer identifier returned by AddTimer()
+   * \param[in] uDelayMs first expiration in milliseconds, 0 disarms the timer
+   * \param[in] uIntervalMs period of further expirations, 0 for a one-shot timer
+   * 
+   * \throw InotifyException thrown if the timer is unknown or cannot be set
+   */
+  void SetTimer(int iTimer, uint32_t uDelayMs, uint32_t uIntervalMs = 0) throw (InotifyException);
+  
+  /// Destroys a timer.
+  /**
+   * If the given timer does not exist it does nothing.
+   * 
+   * \param[in] iTimer timer identifier returned by AddTimer()
+   */
+  void RemoveTimer(int iTimer);
+  
+  /// Adds a descriptor to be watched for reading by WaitForActivity().
+  /**
+   * This allows to multiplex e.g. other inotify instances or sockets
+   * in the same loop. The descriptor is not owned by this object.
+   * 
+   * \param[in] iFd file descriptor
+   * 
+   * \throw InotifyException thrown if the descriptor cannot be added
+   */
+  void AddDescriptor(int iFd) throw (InotifyException);
+  
+  /// Removes a descriptor added by AddDescriptor().
+  /**
+   * If the given descriptor is not present it does nothing.
+   * 
+   * \param[in] iFd file descriptor
+   */
+  void RemoveDescriptor(int iFd);
+  
   /// Returns the count of received and queued events.
   /**
    * This number is related to the events in the queue inside
    * this object, not to the events pending in the kernel.
+   * While other threads extract events it is only a snapshot.
    * 
    * \return count of events
    */
   inline size_t GetEventCount()
   {
-    IN_READ_BEGIN
-    size_t n = (size_t) m_events.size();
-    IN_READ_END
-    return n;
+    size_t uHead = __atomic_load_n(&m_uHead, __ATOMIC_ACQUIRE);
+    size_t uTail = __atomic_load_n(&m_uTail, __ATOMIC_ACQUIRE);
+    size_t uMarker = __atomic_load_n(&m_fOverflow, __ATOMIC_ACQUIRE) ? 1 : 0;
+    return (uTail > uHead ? uTail - uHead : 0) + uMarker;
   }
   
   /// Extracts a queued inotify event.
@@ -660,6 +888,10 @@ public:
    * The extracted event is removed from the queue.
    * If the pointer is NULL it does nothing.
    * 
+   * It is lock-free and may be called from any number of threads
+   * while another thread reads events by WaitForEvents() or
+   * WaitForActivity().
+   * 
    * \param[in,out] pEvt event object
    * 
    * \throw InotifyException thrown if the provided pointer is NULL
@@ -684,6 +916,9 @@ public:
    * The extracted event stays in the queue.
    * If the pointer is NULL it does nothing.
    * 
+   * It is lock-free. If other threads extract events at the
+   * same time the peeked event may already be taken by one of them.
+   * 
    * \param[in,out] pEvt event object
    * 
    * \throw InotifyException thrown if the provided pointer is NULL
@@ -870,16 +1105,48 @@ public:
 
 private: 
   int m_fd;                             ///< file descriptor
+  int m_epfd;                           ///< epoll descriptor for WaitForActivity()
+  int m_wakefd;                         ///< eventfd signalled by Shutdown()
+  volatile sig_atomic_t m_shutdown;     ///< set by Shutdown()
+  std::set<int> m_timers;               ///< timerfd descriptors
+  std::set<int> m_descriptors;          ///< foreign descriptors
   IN_WATCH_MAP m_watches;               ///< watches (by descriptors)
   IN_WP_MAP m_paths;                    ///< watches (by paths)
   unsigned char m_buf[INOTIFY_BUFLEN];  ///< buffer for events
-  std::deque<InotifyEvent> m_events;    ///< event queue
+  
+  /// Event queue slot
+  struct InotifySlot
+  {
+    size_t m_uSeq;                      ///< position the slot is ready for
+    InotifyEvent m_evt;                 ///< event
+  };
+  
+  InotifySlot* m_ring;                  ///< event queue (preallocated slots)
+  bool m_fOverflow;                     ///< events dropped, IN_Q_OVERFLOW pending
+  size_t m_uRetired;                    ///< retired watches not freed yet
+  char m_pad0[INOTIFY_CACHE_LINE];      ///< keeps m_uHead on its own line
+  size_t m_uHead;                       ///< next position to extract
+  char m_pad1[INOTIFY_CACHE_LINE];      ///< keeps m_uTail on its own line
+  size_t m_uTail;                       ///< next position to fill
+  char m_pad2[INOTIFY_CACHE_LINE];      ///< keeps later members off m_uTail
   
   IN_LOCK_DECL
   
   friend class InotifyWatch;
   
   static std::string GetCapabilityPath(InotifyCapability_t cap) throw (InotifyException);
+  
+  bool HandleRecursive(InotifyWatch* pWatch, const InotifyEvent& rEvt);
+  void AddSubtree(InotifyWatch* pRoot, const std::string& rPath);
+  void AddSubdirs(InotifyWatch* pRoot, const std::string& rPath);
+  void RemoveSubtree(InotifyWatch* pRoot, const std::string& rPath);
+  void RetireChild(InotifyWatch* pWatch);
+  void DropChildren(InotifyWatch* pRoot);
+  void FreeRetired();
+  void Push(const InotifyEvent& rEvt);
+  bool HasRoom() const;
+  bool PushSlot(const InotifyEvent& rEvt);
+  bool TakeOverflow();
 };
 
 
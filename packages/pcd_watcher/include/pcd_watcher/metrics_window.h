@@ -0,0 +1,43 @@
+#ifndef PCD_WATCHER_METRICS_WINDOW_H
+#define PCD_WATCHER_METRICS_WINDOW_H
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include <pcd_watcher/Metrics.h>
+#include <pcd_watcher/StageTiming.h>
+
+// Milliseconds on the monotonic clock, for timing stages
+double monotonicMs();
+
+// Keeps the last capacity processed files and summarizes them into a Metrics
+// message: nearest-rank latency percentiles of whole files and of every
+// stage, and input points per second over the time the window covers.
+// Not thread-safe.
+class MetricsWindow
+{
+public:
+    explicit MetricsWindow(size_t capacity);
+    // endMs is monotonicMs() when the file was done, failed files are only counted
+    void add(double endMs, double totalMs, size_t pointsIn, bool ok, bool cached,
+             const std::vector<pcd_watcher::StageTiming>& stages);
+    // Fills everything but stamp, queue_depth and busy_workers
+    void fill(pcd_watcher::Metrics& metrics) const;
+
+private:
+    struct Sample
+    {
+        double startMs;
+        double endMs;
+        double totalMs;
+        size_t pointsIn;
+        std::vector<pcd_watcher::StageTiming> stages;
+    };
+
+    size_t capacity;
+    std::deque<Sample> samples;
+    uint64_t processed;
+    uint64_t failed;
+    uint64_t cacheHits;
+};
+#endif  // PCD_WATCHER_METRICS_WINDOW_H
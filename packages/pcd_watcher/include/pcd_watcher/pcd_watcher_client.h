@@ -2,23 +2,133 @@
 #define PCD_WATCHER_PCD_WATCHER_CLIENT_H
 
 #include <ros/ros.h>
-#include <actionlib/client/simple_action_client.h>
+#include <actionlib/client/action_client.h>
 #include <pcd_watcher/new_pcdAction.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <deque>
+#include <map>
 #include <string>
+#include <utility>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <pcd_watcher/inotify-cxx.h>
 
+// Sends completed files in the watched directory to the server. Files that
+// complete within batchWindow of the first one are sent as one batch goal
+// (up to maxBatch files). Goals the server rejects because its queue is full
+// are resent after retryDelay, so no file is dropped during bursts.
+// Every file the server processed is recorded with its size and mtime in
+// stateFile, files it failed on are not. The directory is rescanned against that record at startup and
+// after the inotify queue overflowed, so files missed while the client was
+// down or events were lost are sent, and files already done are not.
+// With recursive set, files in subdirectories (e.g. one per object or date)
+// are handled too and new subdirectories are picked up as they appear.
 class PcdWatcherClient
 {
 public:
+    typedef actionlib::ActionClient<pcd_watcher::new_pcdAction> NewPcdClient;
+
     PcdWatcherClient();
+    ~PcdWatcherClient();
+    // False if the watch or the event loop's timer and eventfd could not be
+    // set up, the client can't do anything then
+    bool isWatching();
     bool isConnected();
-    void getEvents();
+    // Handles whatever woke the event loop, returns false once shut down
+    bool getEvents();
+    // Makes getEvents return false, safe to call from a signal handler
+    void shutdown();
+    // Dispatches every file in the directory (and its subdirectories if
+    // recursive) that wasn't dispatched yet
+    void scanDirectory();
 
 private:
+    // A closed file that is only dispatched once its size and mtime have
+    // not changed for settleTime seconds
+    struct PendingFile
+    {
+        off_t size;
+        time_t mtime;
+        ros::Time since;
+    };
+
+    // Identifies a version of a file, a file rewritten after it was
+    // dispatched is sent again
+    struct FileStamp
+    {
+        off_t size;
+        int64_t mtimeNs;
+    };
+
+    struct InFlightGoal
+    {
+        std::vector<std::string> filepaths;
+        NewPcdClient::GoalHandle goalHandle;
+    };
+
+    struct RetryBatch
+    {
+        std::vector<std::string> filepaths;
+        ros::Time due;
+    };
+
+    struct FinishedGoal
+    {
+        unsigned long id;
+        bool retry;
+        // Files of the goal the server wrote an output for
+        std::vector<std::string> processed;
+    };
+
+    size_t scanTree(const std::string& dirpath);
+    void fileComplete(const std::string& filepath);
+    void dispatch(const std::string& filepath);
+    void flushBatch();
+    void sendBatch(const std::vector<std::string>& filepaths);
+    void checkPending();
+    void transitionCB(NewPcdClient::GoalHandle goalHandle, unsigned long id, const std::vector<std::string>& filepaths);
+    void reapFinished();
+    void resendDue();
+    void armWakeTimer();
+    static bool stampFile(const std::string& filepath, FileStamp& stamp);
+    void loadState();
+    void recordDone(const std::vector<std::string>& filepaths, const std::vector<std::string>& processed);
+
     ros::NodeHandle nh;
-    pcd_watcher::new_pcdGoal goal;
-    actionlib::SimpleActionClient<pcd_watcher::new_pcdAction> actionClient;
+    NewPcdClient actionClient;
     std::string directory;
+    bool recursive;
+    double settleTime;
+    double retryDelay;
+    double batchWindow;
+    int maxBatch;
+    std::string stateFile;
+    std::map<std::string, PendingFile> pending;
+    std::vector<std::string> batch;
+    ros::Time batchOpened;
+
+    // Stamps of the files dispatched so far, finished ones are also appended
+    // to stateOut
+    std::map<std::string, FileStamp> dispatched;
+    FILE* stateOut;
+    bool rescanNeeded;
+
+    // Goal handles must be kept until the goal is done, otherwise actionlib
+    // stops tracking them. Only the main thread touches inFlight and retries,
+    // transitionCB runs on the spinner thread and only appends to finished.
+    unsigned long nextGoalId;
+    std::map<unsigned long, InFlightGoal> inFlight;
+    std::deque<RetryBatch> retries;
+    boost::mutex finishedMutex;
+    std::vector<FinishedGoal> finished;
     Inotify notify;
+    boost::shared_ptr<InotifyWatch> watch;
+    bool watching;
+    int wakeTimer;
+    // eventfd written by transitionCB so the loop reaps finished goals
+    int finishedFd;
 };
 #endif  // PCD_WATCHER_PCD_WATCHER_CLIENT_H
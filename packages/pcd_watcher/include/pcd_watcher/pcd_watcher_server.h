@@ -2,21 +2,88 @@
 #define PCD_WATCHER_PCD_WATCHER_SERVER_H
 
 #include <ros/ros.h>
-#include <actionlib/server/simple_action_server.h>
+#include <actionlib/server/action_server.h>
 #include <pcd_watcher/new_pcdAction.h>
-#include <std_msgs/String.h>
+#include <pcd_watcher/metrics_window.h>
+#include <model_processing/debug_sink.h>
+#include <model_processing/pipeline.h>
+#include <pcd_watcher/result_cache.h>
+#include <pcd_watcher/results_log.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <deque>
+#include <vector>
 
+// Accepts new_pcd goals into a bounded queue that a pool of worker threads
+// drains, each worker with its own Pipeline. A goal is a batch of files, its
+// files are queued as separate jobs so one batch is spread over all workers,
+// and the goal finishes with the last of them. Goals that don't fit into the
+// queue are rejected so the client can resend them later. The statistics of
+// every cloud go into the goal's result and into the results log. With a
+// result cache, files already processed by the same pipeline are answered
+// from the cache without running it. Every file's stage timings are sent as
+// feedback of its goal, and rolling latency and throughput statistics are
+// published on /pcd_watcher/metrics.
 class PcdWatcherServer
 {
 public:
+    typedef actionlib::ActionServer<pcd_watcher::new_pcdAction> NewPcdServer;
+
     PcdWatcherServer();
-    void newPcdCB(const actionlib::SimpleActionServer<pcd_watcher::new_pcdAction>::GoalConstPtr& goal);
+    ~PcdWatcherServer();
+    void goalCB(NewPcdServer::GoalHandle goalHandle);
+    void cancelCB(NewPcdServer::GoalHandle goalHandle);
 
 private:
+    struct Batch
+    {
+        NewPcdServer::GoalHandle goalHandle;
+        pcd_watcher::new_pcdResult result;
+        size_t remaining;
+        size_t processed;
+        bool canceled;
+    };
+
+    struct Job
+    {
+        boost::shared_ptr<Batch> batch;
+        size_t index;
+    };
+
+    void workerLoop(int worker, int ompThreads);
+    std::string outputName(const std::string& filepath) const;
+    bool process(Pipeline& pipeline, const std::string& filepath, std::string& processedFilepath,
+                 pcd_watcher::CloudResult& cloudResult, std::vector<pcd_watcher::StageTiming>& stages,
+                 bool& cached);
+    void publishMetrics(const ros::TimerEvent& event);
+    void finishJob(Batch& batch, size_t index, bool ok, const std::string& processedFilepath,
+                   const pcd_watcher::CloudResult& cloudResult);
+    void finishBatch(Batch& batch);
+
     ros::NodeHandle nh;
-    actionlib::SimpleActionServer<pcd_watcher::new_pcdAction> actionServer;
-    pcd_watcher::new_pcdGoal goal;
-    pcd_watcher::new_pcdResult result;
-    std_msgs::String feedback;
+    NewPcdServer actionServer;
+    // The client's watched directory, outputs are named after the input's
+    // path relative to it
+    std::string directory;
+    boost::shared_ptr<DebugSink> debugSink;
+    boost::shared_ptr<ResultsLog> resultsLog;
+    boost::shared_ptr<ResultCache> resultCache;
+    std::vector<boost::shared_ptr<Pipeline> > pipelines;
+    boost::thread_group workers;
+
+    // jobsMutex also guards the Batch records the jobs point to
+    std::deque<Job> jobs;
+    size_t maxQueued;
+    size_t busyWorkers;
+    bool stopping;
+    boost::mutex jobsMutex;
+    boost::condition_variable jobsReady;
+
+    MetricsWindow metrics;
+    boost::mutex metricsMutex;
+    ros::Publisher metricsPublisher;
+    ros::Timer metricsTimer;
 };
 #endif  // PCD_WATCHER_PCD_WATCHER_SERVER_H
@@ -0,0 +1,53 @@
+#ifndef PCD_WATCHER_RESULT_CACHE_H
+#define PCD_WATCHER_RESULT_CACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <pcd_watcher/CloudResult.h>
+
+// 64 bit hash (XXH64) of data fed in pieces of any size, so files can be
+// hashed while they are read
+class StreamHash
+{
+public:
+    explicit StreamHash(uint64_t seed = 0);
+    void update(const void* data, size_t size);
+    uint64_t digest() const;
+
+private:
+    void consume(const unsigned char* stripe);
+
+    uint64_t seed;
+    uint64_t acc[4];
+    unsigned char pending[32];
+    size_t pendingSize;
+    uint64_t totalSize;
+};
+
+// On-disk cache of processed clouds, keyed by the hash of the input file's
+// contents and the pipeline description, so the same scan run through the
+// same stages is only processed once. Every entry is a copy of the processed
+// PCD (<key>.pcd) and its statistics (<key>.stats), both written under a
+// temporary name and renamed, so workers can share the directory. Entries
+// are never evicted, deleting the directory clears the cache.
+class ResultCache
+{
+public:
+    explicit ResultCache(const std::string& directory);
+    bool isOpen() const;
+
+    // Hashes filepath together with pipelineDescription, false if the file
+    // can't be read
+    bool key(const std::string& filepath, const std::string& pipelineDescription, std::string& key) const;
+
+    // On a hit the cached cloud is copied to processedFilepath
+    // and the statistics are filled into result, its name fields are kept
+    bool lookup(const std::string& key, const std::string& processedFilepath, pcd_watcher::CloudResult& result) const;
+    void store(const std::string& key, const std::string& processedFilepath,
+               const pcd_watcher::CloudResult& result) const;
+
+private:
+    std::string directory;
+    bool opened;
+};
+#endif  // PCD_WATCHER_RESULT_CACHE_H
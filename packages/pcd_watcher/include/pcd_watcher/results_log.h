@@ -0,0 +1,52 @@
+#ifndef PCD_WATCHER_RESULTS_LOG_H
+#define PCD_WATCHER_RESULTS_LOG_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <pcd_watcher/CloudResult.h>
+#include <pcd_watcher/StageTiming.h>
+
+// Splits a snapshot name of the form <object><angle>-<snapshot>.pcd, as
+// written by model_acquisition (e.g. /tmp/PCD/natty22.5-0.pcd), into its
+// parts. The angle is the longest run of digits and dots before the last
+// dash, so an object name should not end in a digit. Returns false and leaves
+// the outputs untouched for other names.
+bool parseSnapshotName(const std::string& filepath, std::string& object, double& angle, int& snapshot);
+
+// Append-only log of processing results, one JSON object per line:
+//
+//   {"time":1476612345.123,"file":"/tmp/PCD/natty120-0.pcd","object":"natty",
+//    "angle":120,"snapshot":0,"output":"natty120-0_processed.pcd",
+//    "points_in":307200,"points_out":48211,"centroid":[x,y,z],
+//    "min":[x,y,z],"max":[x,y,z],"stages":[{"name":"read","ms":12.3},...]}
+//
+// Records can be looked up by object and angle without parsing free text.
+// append only formats the line into a buffer, a background thread writes
+// the buffer out every flushInterval seconds so workers never wait on disk.
+// Everything still buffered is written when the log is destroyed.
+class ResultsLog
+{
+public:
+    ResultsLog(const std::string& path, double flushInterval = 1.0);
+    ~ResultsLog();
+    bool isOpen() const;
+    void append(const pcd_watcher::CloudResult& result, const std::string& outputFilepath,
+                const std::vector<pcd_watcher::StageTiming>& timings);
+
+private:
+    void flushLoop();
+    void writeOut(std::vector<std::string>& lines);
+
+    FILE* file;
+    double flushInterval;
+    std::vector<std::string> buffer;
+    bool stopping;
+    boost::mutex bufferMutex;
+    boost::condition_variable bufferReady;
+    boost::thread flusher;
+};
+#endif  // PCD_WATCHER_RESULTS_LOG_H
@@ -29,8 +29,14 @@
 #include <fcntl.h>
 #include <fstream>
 #include <cstdio>
+#include <algorithm>
 
+#include <dirent.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 
 // Use this if syscalls not defined
 #ifndef __NR_inotify_init
@@ -232,22 +238,55 @@ void InotifyEvent::DumpTypes(std::string& rStr) const
   DumpTypes(m_uMask, rStr);
 }
 
+void InotifyEvent::GetPath(std::string& rPath) const
+{
+  if (m_pWatch == NULL) {
+    rPath.assign(m_name, m_uLen);
+    return;
+  }
+  
+  rPath = m_pWatch->GetPath();
+  if (m_uLen > 0) {
+    rPath.append("/");
+    rPath.append(m_name, m_uLen);
+  }
+}
+
+
+InotifyWatch::~InotifyWatch()
+{
+  for (size_t i = 0; i < m_children.size(); i++) {
+    delete m_children[i];
+  }
+  for (size_t i = 0; i < m_retired.size(); i++) {
+    delete m_retired[i];
+  }
+  
+  IN_LOCK_DONE
+}
+
 
 void InotifyWatch::SetMask(uint32_t uMask) throw (InotifyException)
 {
   IN_WRITE_BEGIN
   
+  uint32_t uOldMask = m_uMask;
+  m_uMask = uMask;
+  
   if (m_wd != -1) {
-    int wd = inotify_add_watch(m_pInotify->GetDescriptor(), m_path.c_str(), uMask);
+    int wd = inotify_add_watch(m_pInotify->GetDescriptor(), m_path.c_str(), GetKernelMask());
     if (wd != m_wd) {
+      m_uMask = uOldMask;
       IN_WRITE_END_NOTHROW
       throw InotifyException(IN_EXC_MSG("changing mask failed"), wd == -1 ? errno : EINVAL, this); 
     }
   }
   
-  m_uMask = uMask;
-  
   IN_WRITE_END
+  
+  for (size_t i = 0; i < m_children.size(); i++) {
+    m_children[i]->SetMask(uMask);
+  }
 }
 
 void InotifyWatch::SetEnabled(bool fEnabled) throw (InotifyException)
@@ -261,7 +300,7 @@ void InotifyWatch::SetEnabled(bool fEnabled) throw (InotifyException)
   
   if (m_pInotify != NULL) {
     if (fEnabled) {
-      m_wd = inotify_add_watch(m_pInotify->GetDescriptor(), m_path.c_str(), m_uMask);
+      m_wd = inotify_add_watch(m_pInotify->GetDescriptor(), m_path.c_str(), GetKernelMask());
       if (m_wd == -1) {
         IN_WRITE_END_NOTHROW
         throw InotifyException(IN_EXC_MSG("enabling watch failed"), errno, this);
@@ -281,6 +320,10 @@ void InotifyWatch::SetEnabled(bool fEnabled) throw (InotifyException)
   m_fEnabled = fEnabled;
   
   IN_WRITE_END
+  
+  for (size_t i = 0; i < m_children.size(); i++) {
+    m_children[i]->SetEnabled(fEnabled);
+  }
 }
 
 void InotifyWatch::__Disable()
@@ -307,17 +350,60 @@ Inotify::Inotify() throw (InotifyException)
 {
   IN_LOCK_INIT
   
+  m_epfd = -1;
+  m_wakefd = -1;
+  m_shutdown = 0;
+  
+  m_ring = new InotifySlot[INOTIFY_QUEUE_SIZE];
+  for (size_t i = 0; i < INOTIFY_QUEUE_SIZE; i++) {
+    m_ring[i].m_uSeq = i;
+  }
+  m_fOverflow = false;
+  m_uRetired = 0;
+  m_uHead = 0;
+  m_uTail = 0;
+  
   m_fd = inotify_init();
   if (m_fd == -1) {
+    delete[] m_ring;
     IN_LOCK_DONE
     throw InotifyException(IN_EXC_MSG("inotify init failed"), errno, NULL);
   }
+  
+  m_epfd = epoll_create1(EPOLL_CLOEXEC);
+  m_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  bool ok = m_epfd != -1 && m_wakefd != -1;
+  if (ok) {
+    ev.data.fd = m_fd;
+    ok = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_fd, &ev) == 0;
+  }
+  if (ok) {
+    ev.data.fd = m_wakefd;
+    ok = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_wakefd, &ev) == 0;
+  }
+  
+  if (!ok) {
+    int err = errno;
+    if (m_wakefd != -1)
+      close(m_wakefd);
+    if (m_epfd != -1)
+      close(m_epfd);
+    close(m_fd);
+    delete[] m_ring;
+    IN_LOCK_DONE
+    throw InotifyException(IN_EXC_MSG("event loop init failed"), err, NULL);
+  }
 }
   
 Inotify::~Inotify()
 {
   Close();
   
+  delete[] m_ring;
+  
   IN_LOCK_DONE
 }
 
@@ -329,6 +415,19 @@ void Inotify::Close()
     RemoveAll();
     close(m_fd);
     m_fd = -1;
+    
+    std::set<int>::iterator it = m_timers.begin();
+    while (it != m_timers.end()) {
+      close(*it);
+      it++;
+    }
+    m_timers.clear();
+    m_descriptors.clear();
+    
+    close(m_wakefd);
+    m_wakefd = -1;
+    close(m_epfd);
+    m_epfd = -1;
   }
   
   IN_WRITE_END
@@ -354,7 +453,7 @@ void Inotify::Add(InotifyWatch* pWatch) throw (InotifyException)
   if (pWatch->IsEnabled()) {
     
     // try to add watch to kernel
-    int wd = inotify_add_watch(m_fd, pWatch->GetPath().c_str(), pWatch->GetMask());
+    int wd = inotify_add_watch(m_fd, pWatch->GetPath().c_str(), pWatch->GetKernelMask());
     
     // adding failed - go away
     if (wd == -1) {
@@ -367,7 +466,7 @@ void Inotify::Add(InotifyWatch* pWatch) throw (InotifyException)
     if (pW != NULL) {
       
       // try to recover old watch because it may be modified - then go away
-      if (inotify_add_watch(m_fd, pW->GetPath().c_str(), pW->GetMask()) < 0) {
+      if (inotify_add_watch(m_fd, pW->GetPath().c_str(), pW->GetKernelMask()) < 0) {
         IN_WRITE_END_NOTHROW
         throw InotifyException(IN_EXC_MSG("watch collision detected and recovery failed"), errno, this);
       }
@@ -385,6 +484,9 @@ void Inotify::Add(InotifyWatch* pWatch) throw (InotifyException)
   m_paths.insert(IN_WP_MAP::value_type(pWatch->m_path, pWatch));
   pWatch->m_pInotify = this;
   
+  if (pWatch->IsRecursive() && pWatch->m_wd != -1)
+    AddSubdirs(pWatch, pWatch->m_path);
+  
   IN_WRITE_END
 }
 
@@ -413,6 +515,9 @@ void Inotify::Remove(InotifyWatch* pWatch) throw (InotifyException)
   m_paths.erase(pWatch->m_path);
   pWatch->m_pInotify = NULL;
   
+  if (pWatch->IsRecursive() && pWatch->m_pRoot == NULL)
+    DropChildren(pWatch);
+  
   IN_WRITE_END
 }
 
@@ -420,7 +525,19 @@ void Inotify::RemoveAll()
 {
   IN_WRITE_BEGIN
   
+  std::vector<InotifyWatch*> roots;
   IN_WP_MAP::iterator it = m_paths.begin();
+  while (it != m_paths.end()) {
+    InotifyWatch* pW = (*it).second;
+    if (pW->IsRecursive() && pW->m_pRoot == NULL)
+      roots.push_back(pW);
+    it++;
+  }
+  for (size_t i = 0; i < roots.size(); i++) {
+    DropChildren(roots[i]);
+  }
+  
+  it = m_paths.begin();
   while (it != m_paths.end()) {
     InotifyWatch* pW = (*it).second;
     if (pW->m_wd != -1) {
@@ -453,56 +570,417 @@ void Inotify::WaitForEvents(bool fNoIntr) throw (InotifyException)
   
   IN_WRITE_BEGIN
   
+  FreeRetired();
+  
   ssize_t i = 0;
   while (i < len) {
     struct inotify_event* pEvt = (struct inotify_event*) &m_buf[i];
-    InotifyWatch* pW = FindWatch(pEvt->wd);
-    if (pW != NULL) {
-      InotifyEvent evt(pEvt, pW);
-      if (    InotifyEvent::IsType(pW->GetMask(), IN_ONESHOT)
-          ||  InotifyEvent::IsType(evt.GetMask(), IN_IGNORED))
-        pW->__Disable();
-      m_events.push_back(evt);
+    if (InotifyEvent::IsType(pEvt->mask, IN_Q_OVERFLOW)) {
+      // the kernel reports its own overflow with no watch (wd == -1)
+      Push(InotifyEvent(pEvt, NULL));
+    }
+    else {
+      IN_WATCH_MAP::iterator it = m_watches.find(pEvt->wd);
+      if (it != m_watches.end()) {
+        InotifyWatch* pW = (*it).second;
+        InotifyEvent evt(pEvt, pW);
+        // recursive watches may consume events only needed to track the tree
+        if (!pW->IsRecursive() || HandleRecursive(pW, evt)) {
+          if (    InotifyEvent::IsType(pW->GetMask(), IN_ONESHOT)
+              ||  InotifyEvent::IsType(evt.GetMask(), IN_IGNORED))
+            pW->__Disable();
+          Push(evt);
+        }
+      }
     }
     i += INOTIFY_EVENT_SIZE + (ssize_t) pEvt->len;
   }
   
   IN_WRITE_END
 }
+
+bool Inotify::HandleRecursive(InotifyWatch* pWatch, const InotifyEvent& rEvt)
+{
+  InotifyWatch* pRoot = pWatch->m_pRoot != NULL ? pWatch->m_pRoot : pWatch;
   
-bool Inotify::GetEvent(InotifyEvent* pEvt) throw (InotifyException)
+  // a subdirectory is gone - its watch is not visible to the user
+  if (rEvt.IsType(IN_IGNORED)) {
+    if (pWatch->m_pRoot == NULL)
+      return true;
+    RetireChild(pWatch);
+    return false;
+  }
+  
+  if (rEvt.IsType(IN_ISDIR) && rEvt.GetLength() > 0) {
+    std::string path;
+    rEvt.GetPath(path);
+    if (rEvt.IsType(IN_CREATE) || rEvt.IsType(IN_MOVED_TO))
+      AddSubtree(pRoot, path);
+    else if (rEvt.IsType(IN_MOVED_FROM))
+      RemoveSubtree(pRoot, path);
+  }
+  
+  uint32_t uEvents = rEvt.GetMask() & IN_ALL_EVENTS;
+  return uEvents == 0 || (uEvents & pRoot->m_uMask) != 0;
+}
+
+void Inotify::AddSubtree(InotifyWatch* pRoot, const std::string& rPath)
 {
-  if (pEvt == NULL)
-    throw InotifyException(IN_EXC_MSG("null pointer to event"), EINVAL, this);
+  if (m_paths.find(rPath) != m_paths.end())
+    return;
   
-  IN_WRITE_BEGIN
+  // the directory may be gone already - then there is nothing to watch
+  int wd = inotify_add_watch(m_fd, rPath.c_str(), pRoot->GetKernelMask() | IN_ONLYDIR | IN_DONT_FOLLOW);
+  if (wd == -1)
+    return;
   
-  bool b = !m_events.empty();
-  if (b) {
-    *pEvt = m_events.front();
-    m_events.pop_front();
+  // the same directory is watched another way (e.g. bind mount) - restore it
+  IN_WATCH_MAP::iterator it = m_watches.find(wd);
+  if (it != m_watches.end()) {
+    InotifyWatch* pW = (*it).second;
+    inotify_add_watch(m_fd, pW->GetPath().c_str(), pW->GetKernelMask());
+    return;
   }
   
-  IN_WRITE_END
+  InotifyWatch* pW = new InotifyWatch(rPath, pRoot->m_uMask, true, true);
+  pW->m_wd = wd;
+  pW->m_pInotify = this;
+  pW->m_pRoot = pRoot;
+  pRoot->m_children.push_back(pW);
+  m_watches.insert(IN_WATCH_MAP::value_type(wd, pW));
+  m_paths.insert(IN_WP_MAP::value_type(rPath, pW));
+  
+  AddSubdirs(pRoot, rPath);
+}
+
+void Inotify::AddSubdirs(InotifyWatch* pRoot, const std::string& rPath)
+{
+  DIR* pDir = opendir(rPath.c_str());
+  if (pDir == NULL)
+    return;
+  
+  struct dirent* pEnt;
+  while ((pEnt = readdir(pDir)) != NULL) {
+    if (strcmp(pEnt->d_name, ".") == 0 || strcmp(pEnt->d_name, "..") == 0)
+      continue;
     
-  return b;
+    std::string path = rPath + "/" + pEnt->d_name;
+    bool fDir = pEnt->d_type == DT_DIR;
+    if (pEnt->d_type == DT_UNKNOWN) {
+      struct stat st;
+      fDir = lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+    }
+    if (fDir)
+      AddSubtree(pRoot, path);
+  }
+  
+  closedir(pDir);
+}
+
+void Inotify::RemoveSubtree(InotifyWatch* pRoot, const std::string& rPath)
+{
+  std::string prefix = rPath + "/";
+  std::vector<InotifyWatch*>& rChildren = pRoot->m_children;
+  size_t i = 0;
+  while (i < rChildren.size()) {
+    InotifyWatch* pW = rChildren[i];
+    if (pW->m_path == rPath || pW->m_path.compare(0, prefix.size(), prefix) == 0) {
+      // the IN_IGNORED that follows finds no watch and is dropped
+      inotify_rm_watch(m_fd, pW->m_wd);
+      RetireChild(pW);
+    }
+    else {
+      i++;
+    }
+  }
 }
+
+void Inotify::RetireChild(InotifyWatch* pWatch)
+{
+  // queued events may still point to the watch, so it lives until
+  // FreeRetired() finds the queue empty or its root is removed
+  m_watches.erase(pWatch->m_wd);
+  m_paths.erase(pWatch->m_path);
+  pWatch->m_wd = -1;
+  pWatch->m_fEnabled = false;
   
-bool Inotify::PeekEvent(InotifyEvent* pEvt) throw (InotifyException)
+  std::vector<InotifyWatch*>& rChildren = pWatch->m_pRoot->m_children;
+  std::vector<InotifyWatch*>::iterator it = std::find(rChildren.begin(), rChildren.end(), pWatch);
+  if (it != rChildren.end()) {
+    rChildren.erase(it);
+    pWatch->m_pRoot->m_retired.push_back(pWatch);
+    m_uRetired++;
+  }
+}
+
+void Inotify::DropChildren(InotifyWatch* pRoot)
+{
+  for (size_t i = 0; i < pRoot->m_children.size(); i++) {
+    InotifyWatch* pW = pRoot->m_children[i];
+    if (pW->m_wd != -1) {
+      inotify_rm_watch(m_fd, pW->m_wd);
+      m_watches.erase(pW->m_wd);
+    }
+    m_paths.erase(pW->m_path);
+    delete pW;
+  }
+  pRoot->m_children.clear();
+  
+  for (size_t i = 0; i < pRoot->m_retired.size(); i++) {
+    delete pRoot->m_retired[i];
+  }
+  m_uRetired -= pRoot->m_retired.size();
+  pRoot->m_retired.clear();
+}
+
+void Inotify::FreeRetired()
+{
+  // with nothing queued, no event handed out from now on can point to them
+  if (m_uRetired == 0 || __atomic_load_n(&m_uHead, __ATOMIC_ACQUIRE) != m_uTail)
+    return;
+  
+  IN_WATCH_MAP::iterator it = m_watches.begin();
+  while (it != m_watches.end()) {
+    std::vector<InotifyWatch*>& rRetired = (*it).second->m_retired;
+    for (size_t i = 0; i < rRetired.size(); i++) {
+      delete rRetired[i];
+    }
+    rRetired.clear();
+    it++;
+  }
+  m_uRetired = 0;
+}
+
+void Inotify::Push(const InotifyEvent& rEvt)
+{
+  // Only the reading thread pushes; consumers may only take a pending
+  // overflow marker, so m_fOverflow is cleared by whoever delivers it
+  bool fOverflow = rEvt.IsType(IN_Q_OVERFLOW);
+  if (fOverflow)
+    __atomic_store_n(&m_fOverflow, true, __ATOMIC_RELEASE);
+  
+  if (__atomic_load_n(&m_fOverflow, __ATOMIC_ACQUIRE)) {
+    if (!HasRoom())
+      return;
+    if (TakeOverflow()) {
+      InotifyEvent evt;
+      evt.m_uMask = IN_Q_OVERFLOW;
+      PushSlot(evt);
+    }
+    if (fOverflow)
+      return;
+  }
+  
+  if (!PushSlot(rEvt))
+    __atomic_store_n(&m_fOverflow, true, __ATOMIC_RELEASE);
+}
+
+bool Inotify::HasRoom() const
+{
+  size_t uPos = m_uTail;
+  const InotifySlot& rSlot = m_ring[uPos & (INOTIFY_QUEUE_SIZE - 1)];
+  return __atomic_load_n(&rSlot.m_uSeq, __ATOMIC_ACQUIRE) == uPos;
+}
+
+bool Inotify::TakeOverflow()
+{
+  bool fExpected = true;
+  return __atomic_compare_exchange_n(&m_fOverflow, &fExpected, false, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+bool Inotify::PushSlot(const InotifyEvent& rEvt)
+{
+  size_t uPos = m_uTail;
+  InotifySlot& rSlot = m_ring[uPos & (INOTIFY_QUEUE_SIZE - 1)];
+  
+  // the slot is free for this position once the consumer a lap behind is done
+  if (__atomic_load_n(&rSlot.m_uSeq, __ATOMIC_ACQUIRE) != uPos)
+    return false;
+  
+  rSlot.m_evt = rEvt;
+  __atomic_store_n(&rSlot.m_uSeq, uPos + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&m_uTail, uPos + 1, __ATOMIC_RELEASE);
+  return true;
+}
+  
+void Inotify::WaitForActivity(InotifyActivity& rAct, int iTimeoutMs) throw (InotifyException)
+{
+  rAct.fShutdown = false;
+  rAct.fEvents = false;
+  rAct.timers.clear();
+  rAct.descriptors.clear();
+  
+  if (m_epfd == -1)
+    throw InotifyException(IN_EXC_MSG("invalid file descriptor"), EBUSY, this);
+  
+  struct epoll_event evs[16];
+  int n = epoll_wait(m_epfd, evs, 16, iTimeoutMs);
+  if (n == -1) {
+    if (errno == EINTR) {
+      rAct.fShutdown = IsShutdown();
+      return;
+    }
+    throw InotifyException(IN_EXC_MSG("waiting for activity failed"), errno, this);
+  }
+  
+  for (int i = 0; i < n; i++) {
+    int fd = evs[i].data.fd;
+    if (fd == m_wakefd) {
+      // the eventfd is never drained so it keeps every later wait short
+      rAct.fShutdown = true;
+    }
+    else if (fd == m_fd) {
+      // readable, so this read doesn't block
+      WaitForEvents();
+      rAct.fEvents = true;
+    }
+    else if (m_timers.find(fd) != m_timers.end()) {
+      uint64_t expirations;
+      if (read(fd, &expirations, sizeof(expirations)) == (ssize_t) sizeof(expirations))
+        rAct.timers.push_back(fd);
+    }
+    else {
+      rAct.descriptors.push_back(fd);
+    }
+  }
+}
+
+void Inotify::Shutdown()
+{
+  m_shutdown = 1;
+  
+  uint64_t one = 1;
+  if (m_wakefd != -1)
+    (void) write(m_wakefd, &one, sizeof(one));
+}
+
+int Inotify::AddTimer() throw (InotifyException)
+{
+  if (m_epfd == -1)
+    throw InotifyException(IN_EXC_MSG("invalid file descriptor"), EBUSY, this);
+  
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd == -1)
+    throw InotifyException(IN_EXC_MSG("cannot create timer"), errno, this);
+  
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+    int err = errno;
+    close(fd);
+    throw InotifyException(IN_EXC_MSG("cannot add timer"), err, this);
+  }
+  
+  m_timers.insert(fd);
+  return fd;
+}
+
+void Inotify::SetTimer(int iTimer, uint32_t uDelayMs, uint32_t uIntervalMs) throw (InotifyException)
+{
+  if (m_timers.find(iTimer) == m_timers.end())
+    throw InotifyException(IN_EXC_MSG("unknown timer"), EINVAL, this);
+  
+  struct itimerspec spec;
+  spec.it_value.tv_sec = uDelayMs / 1000;
+  spec.it_value.tv_nsec = (long) (uDelayMs % 1000) * 1000000L;
+  spec.it_interval.tv_sec = uIntervalMs / 1000;
+  spec.it_interval.tv_nsec = (long) (uIntervalMs % 1000) * 1000000L;
+  
+  if (timerfd_settime(iTimer, 0, &spec, NULL) == -1)
+    throw InotifyException(IN_EXC_MSG("cannot set timer"), errno, this);
+}
+
+void Inotify::RemoveTimer(int iTimer)
+{
+  if (m_timers.erase(iTimer) == 0)
+    return;
+  
+  epoll_ctl(m_epfd, EPOLL_CTL_DEL, iTimer, NULL);
+  close(iTimer);
+}
+
+void Inotify::AddDescriptor(int iFd) throw (InotifyException)
+{
+  if (m_epfd == -1)
+    throw InotifyException(IN_EXC_MSG("invalid file descriptor"), EBUSY, this);
+  
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = iFd;
+  if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, iFd, &ev) == -1)
+    throw InotifyException(IN_EXC_MSG("cannot add descriptor"), errno, this);
+  
+  m_descriptors.insert(iFd);
+}
+
+void Inotify::RemoveDescriptor(int iFd)
+{
+  if (m_descriptors.erase(iFd) == 0)
+    return;
+  
+  epoll_ctl(m_epfd, EPOLL_CTL_DEL, iFd, NULL);
+}
+  
+bool Inotify::GetEvent(InotifyEvent* pEvt) throw (InotifyException)
 {
   if (pEvt == NULL)
     throw InotifyException(IN_EXC_MSG("null pointer to event"), EINVAL, this);
   
-  IN_READ_BEGIN
-  
-  bool b = !m_events.empty();
-  if (b) {
-    *pEvt = m_events.front();
+  size_t uPos = __atomic_load_n(&m_uHead, __ATOMIC_RELAXED);
+  for (;;) {
+    InotifySlot& rSlot = m_ring[uPos & (INOTIFY_QUEUE_SIZE - 1)];
+    size_t uSeq = __atomic_load_n(&rSlot.m_uSeq, __ATOMIC_ACQUIRE);
+    if (uSeq == uPos + 1) {
+      // filled; claim it (a failed exchange reloads uPos)
+      if (__atomic_compare_exchange_n(&m_uHead, &uPos, uPos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        *pEvt = rSlot.m_evt;
+        __atomic_store_n(&rSlot.m_uSeq, uPos + INOTIFY_QUEUE_SIZE, __ATOMIC_RELEASE);
+        return true;
+      }
+    }
+    else if (uSeq == uPos) {
+      // queue empty - everything before a drop is taken, the marker is next
+      if (__atomic_load_n(&m_fOverflow, __ATOMIC_ACQUIRE) && TakeOverflow()) {
+        *pEvt = InotifyEvent();
+        pEvt->m_uMask = IN_Q_OVERFLOW;
+        return true;
+      }
+      return false;
+    }
+    else {
+      uPos = __atomic_load_n(&m_uHead, __ATOMIC_RELAXED);
+    }
   }
+}
   
-  IN_READ_END
+bool Inotify::PeekEvent(InotifyEvent* pEvt) throw (InotifyException)
+{
+  if (pEvt == NULL)
+    throw InotifyException(IN_EXC_MSG("null pointer to event"), EINVAL, this);
   
-  return b;
+  for (;;) {
+    size_t uPos = __atomic_load_n(&m_uHead, __ATOMIC_ACQUIRE);
+    InotifySlot& rSlot = m_ring[uPos & (INOTIFY_QUEUE_SIZE - 1)];
+    size_t uSeq = __atomic_load_n(&rSlot.m_uSeq, __ATOMIC_ACQUIRE);
+    if (uSeq == uPos) {
+      if (!__atomic_load_n(&m_fOverflow, __ATOMIC_ACQUIRE))
+        return false;
+      *pEvt = InotifyEvent();
+      pEvt->m_uMask = IN_Q_OVERFLOW;
+      return true;
+    }
+    if (uSeq != uPos + 1)
+      continue;
+    
+    // the copy is only valid if no consumer took the slot meanwhile
+    *pEvt = rSlot.m_evt;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&rSlot.m_uSeq, __ATOMIC_RELAXED) == uSeq)
+      return true;
+  }
 }
 
 InotifyWatch* Inotify::FindWatch(int iDescriptor)
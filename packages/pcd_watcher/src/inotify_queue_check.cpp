@@ -0,0 +1,166 @@
+// Checks the Inotify event ring against a real directory:
+//  - a burst larger than the ring, drained only after it ended, must end
+//    with exactly one IN_Q_OVERFLOW (the client rescans on it)
+//  - subdirectories created and removed under a recursive watch, over and
+//    over, must not break event delivery (their watches are retired and freed)
+// Exits with status 1 and a message on the first failure.
+//
+// Usage: inotify_queue_check [files]
+
+#include <pcd_watcher/inotify-cxx.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+
+namespace
+{
+std::string makeTempDir()
+{
+    char path[] = "/tmp/inotify_queue_check_XXXXXX";
+    if (mkdtemp(path) == NULL)
+    {
+        perror("mkdtemp");
+        exit(1);
+    }
+    return path;
+}
+
+void touch(const std::string& path)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        perror(path.c_str());
+        exit(1);
+    }
+    close(fd);
+}
+
+// Moves everything the kernel has into the ring without consuming it
+void readAll(Inotify& notify)
+{
+    for (;;)
+    {
+        size_t before = notify.GetEventCount();
+        notify.WaitForEvents();
+        if (notify.GetEventCount() == before)
+        {
+            return;
+        }
+    }
+}
+
+bool checkOverflowAfterDrain(size_t files)
+{
+    std::string dir = makeTempDir();
+    Inotify notify;
+    notify.SetNonBlock(true);
+    InotifyWatch watch(dir, IN_CREATE);
+    notify.Add(watch);
+
+    for (size_t i = 0; i < files; ++i)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "/%zu", i);
+        touch(dir + name);
+    }
+    readAll(notify);
+
+    // The burst is over: nothing else arrives to carry the marker
+    size_t events = 0;
+    size_t overflows = 0;
+    bool overflowLast = false;
+    InotifyEvent event;
+    while (notify.GetEvent(&event))
+    {
+        bool overflow = event.IsType(IN_Q_OVERFLOW);
+        events += overflow ? 0 : 1;
+        overflows += overflow ? 1 : 0;
+        overflowLast = overflow;
+    }
+
+    for (size_t i = 0; i < files; ++i)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "/%zu", i);
+        unlink((dir + name).c_str());
+    }
+    notify.Remove(watch);
+    rmdir(dir.c_str());
+
+    bool expectOverflow = files > INOTIFY_QUEUE_SIZE;
+    printf("{\"check\":\"overflow_after_drain\",\"files\":%zu,\"events\":%zu,\"overflows\":%zu}\n", files, events,
+           overflows);
+    if (expectOverflow ? overflows != 1 || !overflowLast : overflows != 0 || events != files)
+    {
+        fprintf(stderr, "expected %s, got %zu events and %zu IN_Q_OVERFLOW\n",
+                expectOverflow ? "one trailing IN_Q_OVERFLOW" : "every event and no IN_Q_OVERFLOW", events,
+                overflows);
+        return false;
+    }
+    return true;
+}
+
+bool checkSubdirectoryChurn(size_t rounds)
+{
+    std::string dir = makeTempDir();
+    Inotify notify;
+    notify.SetNonBlock(true);
+    InotifyWatch watch(dir, IN_CLOSE_WRITE, true, true);
+    notify.Add(watch);
+
+    size_t seen = 0;
+    for (size_t i = 0; i < rounds; ++i)
+    {
+        std::string sub = dir + "/sub";
+        mkdir(sub.c_str(), 0755);
+        readAll(notify);
+        touch(sub + "/file.pcd");
+        unlink((sub + "/file.pcd").c_str());
+        rmdir(sub.c_str());
+        readAll(notify);
+
+        InotifyEvent event;
+        while (notify.GetEvent(&event))
+        {
+            if (event.IsType(IN_CLOSE_WRITE) && event.GetName() == "file.pcd")
+            {
+                seen++;
+            }
+        }
+    }
+    notify.Remove(watch);
+    rmdir(dir.c_str());
+
+    printf("{\"check\":\"subdirectory_churn\",\"rounds\":%zu,\"events\":%zu}\n", rounds, seen);
+    if (seen != rounds)
+    {
+        fprintf(stderr, "expected %zu writes in the recreated subdirectory, got %zu\n", rounds, seen);
+        return false;
+    }
+    return true;
+}
+}
+
+int main(int argc, char** argv)
+{
+    size_t files = argc > 1 ? strtoul(argv[1], NULL, 10) : 3 * INOTIFY_QUEUE_SIZE;
+
+    try
+    {
+        bool ok = checkOverflowAfterDrain(INOTIFY_QUEUE_SIZE / 2);
+        ok = checkOverflowAfterDrain(files) && ok;
+        ok = checkSubdirectoryChurn(200) && ok;
+        return ok ? 0 : 1;
+    }
+    catch (InotifyException& e)
+    {
+        fprintf(stderr, "%s: %s\n", e.GetMessage().c_str(), strerror(e.GetErrorNumber()));
+        return 1;
+    }
+}
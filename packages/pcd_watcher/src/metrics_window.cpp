@@ -0,0 +1,120 @@
+#include <pcd_watcher/metrics_window.h>
+#include <time.h>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+
+namespace
+{
+// Nearest-rank percentile, sorted must not be empty
+double percentile(const std::vector<double>& sorted, double p)
+{
+    size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[std::max<size_t>(rank, 1) - 1];
+}
+}
+
+double monotonicMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+MetricsWindow::MetricsWindow(size_t capacity) :
+        capacity(std::max<size_t>(1, capacity)),
+        processed(0),
+        failed(0),
+        cacheHits(0)
+{
+}
+
+void MetricsWindow::add(double endMs, double totalMs, size_t pointsIn, bool ok, bool cached,
+                        const std::vector<pcd_watcher::StageTiming>& stages)
+{
+    if (!ok)
+    {
+        failed++;
+        return;
+    }
+    processed++;
+    if (cached)
+    {
+        cacheHits++;
+    }
+
+    if (samples.size() == capacity)
+    {
+        samples.pop_front();
+    }
+    Sample sample;
+    sample.startMs = endMs - totalMs;
+    sample.endMs = endMs;
+    sample.totalMs = totalMs;
+    sample.pointsIn = pointsIn;
+    sample.stages = stages;
+    samples.push_back(sample);
+}
+
+void MetricsWindow::fill(pcd_watcher::Metrics& metrics) const
+{
+    metrics.window_size = samples.size();
+    metrics.processed = processed;
+    metrics.failed = failed;
+    metrics.cache_hits = cacheHits;
+    metrics.p50_ms = metrics.p95_ms = metrics.p99_ms = 0.0;
+    metrics.points_per_sec = 0.0;
+    metrics.stages.clear();
+    if (samples.empty())
+    {
+        return;
+    }
+
+    // Stages are listed in the order they first appear, which is the order they run
+    std::vector<double> totals;
+    std::vector<std::string> stageOrder;
+    std::map<std::string, std::vector<double> > stageTimes;
+    double firstStart = samples.front().startMs;
+    double lastEnd = samples.front().endMs;
+    double points = 0.0;
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        const Sample& sample = samples[i];
+        totals.push_back(sample.totalMs);
+        firstStart = std::min(firstStart, sample.startMs);
+        lastEnd = std::max(lastEnd, sample.endMs);
+        points += sample.pointsIn;
+        for (size_t j = 0; j < sample.stages.size(); ++j)
+        {
+            std::vector<double>& times = stageTimes[sample.stages[j].name];
+            if (times.empty())
+            {
+                stageOrder.push_back(sample.stages[j].name);
+            }
+            times.push_back(sample.stages[j].milliseconds);
+        }
+    }
+
+    std::sort(totals.begin(), totals.end());
+    metrics.p50_ms = percentile(totals, 50);
+    metrics.p95_ms = percentile(totals, 95);
+    metrics.p99_ms = percentile(totals, 99);
+    if (lastEnd > firstStart)
+    {
+        metrics.points_per_sec = points / ((lastEnd - firstStart) / 1e3);
+    }
+
+    for (size_t i = 0; i < stageOrder.size(); ++i)
+    {
+        std::vector<double>& times = stageTimes[stageOrder[i]];
+        std::sort(times.begin(), times.end());
+        pcd_watcher::StageStats stats;
+        stats.name = stageOrder[i];
+        stats.count = times.size();
+        stats.p50_ms = percentile(times, 50);
+        stats.p95_ms = percentile(times, 95);
+        stats.p99_ms = percentile(times, 99);
+        metrics.stages.push_back(stats);
+    }
+}
@@ -3,21 +3,76 @@
 #include <string>
 #include <pcd_watcher/inotify-cxx.h>
 #include <exception>
+#include <algorithm>
+#include <fstream>
+#include <set>
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
 
 PcdWatcherClient::PcdWatcherClient() :
-        actionClient("new_pcd", true)
+        actionClient("new_pcd"),
+        stateOut(NULL),
+        rescanNeeded(false),
+        nextGoalId(0),
+        watching(false),
+        wakeTimer(-1),
+        finishedFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
 {
     ROS_INFO("In constructor of PcdWatcherClient...");
     if (!nh.getParam("pcd_watcher_client/directory", directory))
     {
         directory = "/tmp/PCD";
     }
+    if (!nh.getParam("pcd_watcher_client/settle_time", settleTime))
+    {
+        settleTime = 0.0;
+    }
+    if (!nh.getParam("pcd_watcher_client/retry_delay", retryDelay))
+    {
+        retryDelay = 1.0;
+    }
+    if (!nh.getParam("pcd_watcher_client/batch_window", batchWindow))
+    {
+        batchWindow = 0.5;
+    }
+    if (!nh.getParam("pcd_watcher_client/max_batch", maxBatch))
+    {
+        maxBatch = 32;
+    }
+    if (!nh.getParam("pcd_watcher_client/recursive", recursive))
+    {
+        recursive = true;
+    }
+    if (!nh.getParam("pcd_watcher_client/state_file", stateFile))
+    {
+        stateFile = directory + "/.pcd_watcher_state";
+    }
     ROS_INFO("PcdWatcherClient created that is watching %s", directory.c_str());
-     
-    InotifyWatch watch(directory, IN_CREATE); 
+    if (!stateFile.empty())
+    {
+        loadState();
+    }
+
+    // A file is complete once its writer closes it, or once it is renamed into
+    // the directory by writers that write to a temporary name first. New
+    // subdirectories are reported by IN_CREATE.
+    uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO;
+    if (recursive)
+    {
+        mask |= IN_CREATE;
+    }
+    watch.reset(new InotifyWatch(directory, mask, true, recursive));
     try
     {
-        notify.Add(watch);
+        wakeTimer = notify.AddTimer();
+        notify.AddDescriptor(finishedFd);
+        notify.Add(watch.get());
+        watching = true;
     }
     catch (InotifyException &e)
     {
@@ -34,35 +89,482 @@ PcdWatcherClient::PcdWatcherClient() :
     ROS_INFO("Exiting PcdWatcherClient constructor");
 }
 
+PcdWatcherClient::~PcdWatcherClient()
+{
+    notify.Close();
+    close(finishedFd);
+    if (stateOut != NULL)
+    {
+        fclose(stateOut);
+    }
+}
+
+void PcdWatcherClient::shutdown()
+{
+    notify.Shutdown();
+}
+
+bool PcdWatcherClient::isWatching()
+{
+    return watching;
+}
+
 bool PcdWatcherClient::isConnected()
 {
-    return actionClient.waitForServer(ros::Duration(5.0));
+    return actionClient.waitForActionServerToStart(ros::Duration(5.0));
+}
+
+bool PcdWatcherClient::stampFile(const std::string& filepath, FileStamp& stamp)
+{
+    struct stat st;
+    if (stat(filepath.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        return false;
+    }
+    stamp.size = st.st_size;
+    stamp.mtimeNs = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
+}
+
+void PcdWatcherClient::loadState()
+{
+    std::ifstream in(stateFile.c_str());
+    long long size, mtimeNs;
+    std::string filepath;
+    while (in >> size >> mtimeNs && in.get() == ' ' && std::getline(in, filepath))
+    {
+        FileStamp& stamp = dispatched[filepath];
+        stamp.size = size;
+        stamp.mtimeNs = mtimeNs;
+    }
+    in.close();
+
+    // Rewrite the record with only the files that are still there unchanged,
+    // so it doesn't grow forever and changed files are sent again
+    std::string tmpFile = stateFile + ".tmp";
+    FILE* out = fopen(tmpFile.c_str(), "w");
+    std::map<std::string, FileStamp>::iterator it = dispatched.begin();
+    while (it != dispatched.end())
+    {
+        FileStamp current;
+        if (!stampFile(it->first, current) || current.size != it->second.size
+            || current.mtimeNs != it->second.mtimeNs)
+        {
+            dispatched.erase(it++);
+            continue;
+        }
+        if (out != NULL)
+        {
+            fprintf(out, "%lld %lld %s\n", static_cast<long long>(current.size),
+                    static_cast<long long>(current.mtimeNs), it->first.c_str());
+        }
+        ++it;
+    }
+    if (out == NULL || fclose(out) != 0 || rename(tmpFile.c_str(), stateFile.c_str()) != 0)
+    {
+        ROS_WARN("Could not rewrite %s: %s", stateFile.c_str(), strerror(errno));
+    }
+
+    stateOut = fopen(stateFile.c_str(), "a");
+    if (stateOut == NULL)
+    {
+        ROS_WARN("Could not open %s, finished files won't be remembered: %s", stateFile.c_str(),
+                 strerror(errno));
+    }
+    ROS_INFO("%zu files were already processed", dispatched.size());
+}
+
+void PcdWatcherClient::recordDone(const std::vector<std::string>& filepaths,
+                                  const std::vector<std::string>& processed)
+{
+    std::set<std::string> ok(processed.begin(), processed.end());
+    for (size_t i = 0; i < filepaths.size(); ++i)
+    {
+        std::map<std::string, FileStamp>::iterator it = dispatched.find(filepaths[i]);
+        if (it == dispatched.end())
+        {
+            continue;
+        }
+        if (ok.count(filepaths[i]) == 0)
+        {
+            // Forget the failed file so the next rescan sends it again
+            dispatched.erase(it);
+        }
+        else if (stateOut != NULL)
+        {
+            fprintf(stateOut, "%lld %lld %s\n", static_cast<long long>(it->second.size),
+                    static_cast<long long>(it->second.mtimeNs), it->first.c_str());
+        }
+    }
+    if (stateOut != NULL)
+    {
+        fflush(stateOut);
+    }
+}
+
+void PcdWatcherClient::scanDirectory()
+{
+    size_t found = scanTree(directory);
+    ROS_INFO("Scanned %s, %zu files were not sent yet", directory.c_str(), found);
+}
+
+size_t PcdWatcherClient::scanTree(const std::string& dirpath)
+{
+    DIR* dir = opendir(dirpath.c_str());
+    if (dir == NULL)
+    {
+        ROS_WARN("Could not scan %s: %s", dirpath.c_str(), strerror(errno));
+        return 0;
+    }
+
+    size_t found = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        // Hidden files are skipped like in fileComplete, this also skips . and ..
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+        std::string filepath = dirpath + "/" + entry->d_name;
+        bool isDir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN)
+        {
+            struct stat st;
+            isDir = lstat(filepath.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+        }
+        if (isDir)
+        {
+            if (recursive)
+            {
+                found += scanTree(filepath);
+            }
+            continue;
+        }
+        if (entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN)
+        {
+            continue;
+        }
+        if (pending.count(filepath) > 0)
+        {
+            continue;
+        }
+        FileStamp stamp;
+        if (!stampFile(filepath, stamp))
+        {
+            continue;
+        }
+        std::map<std::string, FileStamp>::const_iterator it = dispatched.find(filepath);
+        if (it != dispatched.end() && it->second.size == stamp.size && it->second.mtimeNs == stamp.mtimeNs)
+        {
+            continue;
+        }
+        found++;
+        fileComplete(filepath);
+    }
+    closedir(dir);
+    return found;
+}
+
+void PcdWatcherClient::fileComplete(const std::string& filepath)
+{
+    // Hidden files are writers' temporary files or our own state file
+    std::string::size_type slash = filepath.rfind('/');
+    if (filepath[slash == std::string::npos ? 0 : slash + 1] == '.')
+    {
+        return;
+    }
+
+    if (settleTime <= 0.0)
+    {
+        dispatch(filepath);
+    }
+    else
+    {
+        // Let checkPending pick up the current size as the first sample
+        PendingFile file;
+        file.size = -1;
+        file.mtime = 0;
+        file.since = ros::Time::now();
+        pending[filepath] = file;
+    }
+}
+
+void PcdWatcherClient::dispatch(const std::string& filepath)
+{
+    FileStamp stamp;
+    if (!stampFile(filepath, stamp))
+    {
+        ROS_WARN("%s disappeared before it was sent", filepath.c_str());
+        return;
+    }
+    std::map<std::string, FileStamp>::iterator it = dispatched.find(filepath);
+    if (it != dispatched.end() && it->second.size == stamp.size && it->second.mtimeNs == stamp.mtimeNs)
+    {
+        return;
+    }
+    dispatched[filepath] = stamp;
+
+    ROS_INFO("New file %s is complete", filepath.c_str());
+    if (batch.empty())
+    {
+        batchOpened = ros::Time::now();
+    }
+    batch.push_back(filepath);
+    flushBatch();
+}
+
+void PcdWatcherClient::flushBatch()
+{
+    if (batch.empty())
+    {
+        return;
+    }
+    if (batchWindow <= 0.0 || static_cast<int>(batch.size()) >= maxBatch
+        || (ros::Time::now() - batchOpened).toSec() >= batchWindow)
+    {
+        sendBatch(batch);
+        batch.clear();
+    }
+}
+
+void PcdWatcherClient::sendBatch(const std::vector<std::string>& filepaths)
+{
+    ROS_INFO("Sending goal with %zu files", filepaths.size());
+    pcd_watcher::new_pcdGoal goal;
+    goal.newFilepaths = filepaths;
+
+    unsigned long id = nextGoalId++;
+    InFlightGoal& entry = inFlight[id];
+    entry.filepaths = filepaths;
+    entry.goalHandle = actionClient.sendGoal(goal,
+            boost::bind(&PcdWatcherClient::transitionCB, this, _1, id, filepaths));
 }
 
-void PcdWatcherClient::getEvents()
+void PcdWatcherClient::transitionCB(NewPcdClient::GoalHandle goalHandle, unsigned long id,
+                                    const std::vector<std::string>& filepaths)
+{
+    if (goalHandle.getCommState() != actionlib::CommState::DONE)
+    {
+        return;
+    }
+
+    actionlib::TerminalState state = goalHandle.getTerminalState();
+    FinishedGoal goal;
+    goal.id = id;
+    goal.retry = false;
+
+    // Only files the server wrote an output for are done, aborted goals may
+    // still carry the outputs of the files finished before the abort
+    pcd_watcher::new_pcdResultConstPtr result = goalHandle.getResult();
+    if (result)
+    {
+        const std::vector<std::string>& processed = result->processedFilepaths;
+        for (size_t i = 0; i < processed.size() && i < filepaths.size(); ++i)
+        {
+            if (!processed[i].empty())
+            {
+                goal.processed.push_back(filepaths[i]);
+            }
+        }
+    }
+
+    if (state == actionlib::TerminalState::SUCCEEDED)
+    {
+        const std::vector<std::string>& processed = result->processedFilepaths;
+        for (size_t i = 0; i < processed.size() && i < filepaths.size(); ++i)
+        {
+            if (!processed[i].empty())
+            {
+                ROS_INFO("%s processed into %s", filepaths[i].c_str(), processed[i].c_str());
+            }
+        }
+        const std::vector<std::string>& failed = result->failedFilepaths;
+        for (size_t i = 0; i < failed.size(); ++i)
+        {
+            ROS_WARN("%s could not be processed", failed[i].c_str());
+        }
+    }
+    else if (state == actionlib::TerminalState::REJECTED || state == actionlib::TerminalState::RECALLED
+             || state == actionlib::TerminalState::LOST)
+    {
+        ROS_WARN("Goal with %zu files was %s, resending in %.1f s", filepaths.size(), state.toString().c_str(),
+                 retryDelay);
+        goal.retry = true;
+    }
+    else
+    {
+        ROS_WARN("Goal with %zu files finished as %s: %s", filepaths.size(), state.toString().c_str(),
+                 state.getText().c_str());
+    }
+
+    {
+        boost::mutex::scoped_lock lock(finishedMutex);
+        finished.push_back(goal);
+    }
+    uint64_t one = 1;
+    if (write(finishedFd, &one, sizeof(one)) != sizeof(one))
+    {
+        ROS_WARN("Could not wake up the event loop");
+    }
+}
+
+void PcdWatcherClient::reapFinished()
+{
+    uint64_t count;
+    if (read(finishedFd, &count, sizeof(count)) != sizeof(count))
+    {
+        return;
+    }
+
+    std::vector<FinishedGoal> done;
+    {
+        boost::mutex::scoped_lock lock(finishedMutex);
+        done.swap(finished);
+    }
+
+    ros::Time now = ros::Time::now();
+    for (size_t i = 0; i < done.size(); ++i)
+    {
+        std::map<unsigned long, InFlightGoal>::iterator it = inFlight.find(done[i].id);
+        if (it == inFlight.end())
+        {
+            continue;
+        }
+        if (done[i].retry)
+        {
+            RetryBatch retry;
+            retry.filepaths = it->second.filepaths;
+            retry.due = now + ros::Duration(retryDelay);
+            retries.push_back(retry);
+        }
+        else
+        {
+            recordDone(it->second.filepaths, done[i].processed);
+        }
+        inFlight.erase(it);
+    }
+}
+
+void PcdWatcherClient::resendDue()
+{
+    ros::Time now = ros::Time::now();
+    while (!retries.empty() && retries.front().due <= now)
+    {
+        sendBatch(retries.front().filepaths);
+        retries.pop_front();
+    }
+}
+
+void PcdWatcherClient::checkPending()
+{
+    ros::Time now = ros::Time::now();
+    std::map<std::string, PendingFile>::iterator it = pending.begin();
+    while (it != pending.end())
+    {
+        struct stat st;
+        if (stat(it->first.c_str(), &st) != 0)
+        {
+            ROS_WARN("%s disappeared before it settled", it->first.c_str());
+            pending.erase(it++);
+        }
+        else if (st.st_size != it->second.size || st.st_mtime != it->second.mtime)
+        {
+            it->second.size = st.st_size;
+            it->second.mtime = st.st_mtime;
+            it->second.since = now;
+            ++it;
+        }
+        else if ((now - it->second.since).toSec() >= settleTime)
+        {
+            dispatch(it->first);
+            pending.erase(it++);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+void PcdWatcherClient::armWakeTimer()
+{
+    // The timer only has to fire when something is due: a settling file needs
+    // another stat, the open batch has to be sent or a retry is due.
+    // Finished goals wake the loop through finishedFd instead.
+    ros::Time now = ros::Time::now();
+    double next = -1.0;
+    if (!pending.empty())
+    {
+        next = std::max(0.01, settleTime / 4.0);
+    }
+    if (!batch.empty())
+    {
+        double left = std::max(0.0, batchWindow - (now - batchOpened).toSec());
+        next = next < 0.0 ? left : std::min(next, left);
+    }
+    if (!retries.empty())
+    {
+        double left = std::max(0.0, (retries.front().due - now).toSec());
+        next = next < 0.0 ? left : std::min(next, left);
+    }
+
+    // A zero delay would disarm the timer, so wait at least 1 ms
+    uint32_t delay_ms = next < 0.0 ? 0 : std::max<uint32_t>(1, static_cast<uint32_t>(next * 1000.0));
+    notify.SetTimer(wakeTimer, delay_ms);
+}
+
+bool PcdWatcherClient::getEvents()
 {
     try
     {
-        notify.WaitForEvents();
-        size_t count = notify.GetEventCount();
+        armWakeTimer();
+        InotifyActivity activity;
+        notify.WaitForActivity(activity);
+        if (activity.fShutdown)
+        {
+            return false;
+        }
+
         InotifyEvent event;
-        bool got_event;
-        std::string filename;
         std::string filepath;
-
-        for (int i = 0; i < count; i++)
+        while (notify.GetEvent(&event))
         {
-            got_event = notify.GetEvent(&event);
-            if (got_event)
+            if (event.IsType(IN_Q_OVERFLOW))
+            {
+                ROS_WARN("Inotify event queue overflowed, rescanning %s", directory.c_str());
+                rescanNeeded = true;
+            }
+            else if (event.IsType(IN_ISDIR))
+            {
+                // Files may have been written to a new subdirectory before
+                // its watch was added
+                if (event.IsType(IN_CREATE) || event.IsType(IN_MOVED_TO))
+                {
+                    event.GetPath(filepath);
+                    size_t found = scanTree(filepath);
+                    if (found > 0)
+                    {
+                        ROS_INFO("New directory %s already had %zu files", filepath.c_str(), found);
+                    }
+                }
+            }
+            else if (event.IsType(IN_CLOSE_WRITE) || event.IsType(IN_MOVED_TO))
             {
-                filename = event.GetName();
-                filepath = directory + "/" + filename;
-                ROS_INFO("Event detected, new file %s created", filepath.c_str());
-                goal.newFilepath = filepath;
-		ros::Duration(4.0).sleep();
-                actionClient.sendGoal(goal);
+                event.GetPath(filepath);
+                fileComplete(filepath);
             }
         }
+        if (rescanNeeded)
+        {
+            rescanNeeded = false;
+            scanDirectory();
+        }
+
+        reapFinished();
+        resendDue();
+        checkPending();
+        flushBatch();
     }
     catch (InotifyException &e)
     {
@@ -76,12 +578,38 @@ void PcdWatcherClient::getEvents()
     {
         ROS_WARN("Uknown exception occured");
     }
+    return !notify.IsShutdown();
+}
+
+PcdWatcherClient* g_client = NULL;
+
+// Replaces roscpp's SIGINT handler so a client blocked waiting for file
+// events wakes up and exits right away
+void sigintHandler(int sig)
+{
+    if (g_client != NULL)
+    {
+        g_client->shutdown();
+    }
+    ros::requestShutdown();
 }
 
 int main(int argc, char **argv)
 {
-    ros::init(argc, argv, "pcd_watcher_client");
+    ros::init(argc, argv, "pcd_watcher_client", ros::init_options::NoSigintHandler);
     PcdWatcherClient client;
+    if (!client.isWatching())
+    {
+        ROS_FATAL("Could not set up watching the directory, exiting");
+        return 1;
+    }
+    g_client = &client;
+    signal(SIGINT, sigintHandler);
+
+    // Goal status updates are handled on this thread while the main thread
+    // waits for file events
+    ros::AsyncSpinner spinner(1);
+    spinner.start();
 
     ROS_INFO("Waiting for server...");
     bool server_exists = client.isConnected();
@@ -99,10 +627,13 @@ int main(int argc, char **argv)
     }
     ROS_INFO("Connected to pcd_watcher_server!");
 
-    bool got_event = false;
-    while (ros::ok)
+    // Files that arrived while the client wasn't running
+    client.scanDirectory();
+
+    while (ros::ok() && client.getEvents())
     {
-        client.getEvents();
     }
+    g_client = NULL;
+    ros::shutdown();
     return 0;
 }
@@ -2,49 +2,425 @@
 #include <pcd_watcher/pcd_watcher_server.h>
 #include <pcd_watcher/new_pcdAction.h>
 #include <model_processing/model_processing.h>
-#include <iostream>
-#include <fstream>
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 PcdWatcherServer::PcdWatcherServer() :
-        actionServer(nh, "new_pcd", boost::bind(&PcdWatcherServer::newPcdCB, this, _1), false)
+        actionServer(nh, "new_pcd", boost::bind(&PcdWatcherServer::goalCB, this, _1),
+                     boost::bind(&PcdWatcherServer::cancelCB, this, _1), false),
+        busyWorkers(0),
+        stopping(false),
+        metrics(200)
 {
     ROS_INFO("In constructor of PcdWatcherServer...");
+    if (!nh.getParam("pcd_watcher_server/directory", directory))
+    {
+        directory = "/tmp/PCD";
+    }
+    while (directory.size() > 1 && directory[directory.size() - 1] == '/')
+    {
+        directory.erase(directory.size() - 1);
+    }
+
+    std::string debug_dir;
+    if (nh.getParam("pcd_watcher_server/debug_dir", debug_dir) && !debug_dir.empty())
+    {
+        ROS_INFO("Dumping intermediate clouds to %s", debug_dir.c_str());
+        debugSink.reset(new DebugSink(debug_dir));
+    }
+
+    std::string results_log = "results.jsonl";
+    nh.getParam("pcd_watcher_server/results_log", results_log);
+    if (!results_log.empty())
+    {
+        ROS_INFO("Appending results to %s", results_log.c_str());
+        resultsLog.reset(new ResultsLog(results_log));
+    }
+
+    std::string cache_dir;
+    if (nh.getParam("pcd_watcher_server/cache_dir", cache_dir) && !cache_dir.empty())
+    {
+        resultCache.reset(new ResultCache(cache_dir));
+        if (resultCache->isOpen())
+        {
+            ROS_INFO("Caching results in %s", cache_dir.c_str());
+        }
+        else
+        {
+            resultCache.reset();
+        }
+    }
+
+    int metrics_window = 200;
+    double metrics_period = 1.0;
+    nh.getParam("pcd_watcher_server/metrics_window", metrics_window);
+    nh.getParam("pcd_watcher_server/metrics_period", metrics_period);
+    metrics = MetricsWindow(std::max(1, metrics_window));
+    metricsPublisher = nh.advertise<pcd_watcher::Metrics>("/pcd_watcher/metrics", 1);
+    metricsTimer = nh.createTimer(ros::Duration(metrics_period), &PcdWatcherServer::publishMetrics, this);
+
+    int cores = std::max(1, static_cast<int>(boost::thread::hardware_concurrency()));
+    int n_workers = cores;
+    int max_queued = 32;
+    nh.getParam("pcd_watcher_server/workers", n_workers);
+    nh.getParam("pcd_watcher_server/max_queued", max_queued);
+    n_workers = std::max(1, n_workers);
+    maxQueued = std::max(1, max_queued);
+
+    for (int i = 0; i < n_workers; ++i)
+    {
+        boost::shared_ptr<Pipeline> pipeline(new Pipeline);
+        std::string error;
+        if (!pipeline->load(nh, "pcd_watcher_server/pipeline", error))
+        {
+            if (i == 0)
+            {
+                ROS_WARN("Using the default pipeline: %s", error.c_str());
+            }
+            pipeline->load_default();
+        }
+        pipelines.push_back(pipeline);
+    }
+    ROS_INFO("Pipeline: %s", pipelines[0]->describe().c_str());
+
+    // Split the cores between the workers so their OpenMP stages don't
+    // oversubscribe the machine when every worker is busy
+    int omp_threads = std::max(1, cores / n_workers);
+    ROS_INFO("Starting %d workers with %d threads each, queue limit %zu", n_workers, omp_threads, maxQueued);
+    for (int i = 0; i < n_workers; ++i)
+    {
+        workers.create_thread(boost::bind(&PcdWatcherServer::workerLoop, this, i, omp_threads));
+    }
+
     ROS_INFO("Starting action server...");
     actionServer.start();
     ROS_INFO("Started action server.");
     ROS_INFO("Exiting PcdWatcherServer constructor");
 }
 
-void PcdWatcherServer::newPcdCB(const actionlib::SimpleActionServer<pcd_watcher::new_pcdAction>::GoalConstPtr& goal)
-{
-    ROS_INFO("In the newPcd callback function...");
-    ROS_INFO("Received goal message, new file is %s", goal->newFilepath.c_str());
-    
-    ModelProcessing model_processing;
-    pcl::PointCloud<pcl::PointXYZRGB>::Ptr new_cloud (new pcl::PointCloud<pcl::PointXYZRGB>);
-    new_cloud = model_processing.pcd_reader(goal->newFilepath);
-    new_cloud = model_processing.remove_outlier(new_cloud);
-    
-    //new_cloud = model_processing.downsampler(new_cloud);
-
-    float minMax[6];
-    model_processing.bounding_box(new_cloud, minMax);
-    
-    Eigen::Vector3f centroid = model_processing.computeCentroid(new_cloud);
-
-    result.processedFilepath = model_processing.pcd_writer(new_cloud,goal->newFilepath);
-    
-    std::ofstream myfile;
-    myfile.open ("results.txt");
-    myfile << "Object:" << goal->newFilepath << "\n";
-    myfile << "Centroid:" << centroid << "\n";
-    myfile << "Min (x,y,z):" << minMax[0] << "," << minMax[1] << "," << minMax[2] << "\n" << "Max (x,y,z):" << minMax[3] << "," << minMax[4] << "," << minMax[5] << "\n\n";
-    myfile.close();
-	
-    ROS_INFO_STREAM(centroid);
-    ROS_INFO_STREAM(minMax[0] << "," << minMax[1] << "," << minMax[2] << "," << minMax[3] << "," << minMax[4] << "," << minMax[5]);
-    ROS_INFO("Exiting newPcd callback function");
-    actionServer.setSucceeded(result);
+PcdWatcherServer::~PcdWatcherServer()
+{
+    {
+        boost::mutex::scoped_lock lock(jobsMutex);
+        stopping = true;
+    }
+    jobsReady.notify_all();
+    workers.join_all();
+
+    // Goals still queued were accepted but will never run
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        Batch& batch = *jobs[i].batch;
+        batch.result.failedFilepaths.push_back(batch.goalHandle.getGoal()->newFilepaths[jobs[i].index]);
+        if (--batch.remaining == 0)
+        {
+            batch.goalHandle.setAborted(batch.result, "Server shutting down");
+        }
+    }
+}
+
+void PcdWatcherServer::goalCB(NewPcdServer::GoalHandle goalHandle)
+{
+    const std::vector<std::string>& filepaths = goalHandle.getGoal()->newFilepaths;
+    ROS_INFO("Received goal message with %zu new files", filepaths.size());
+    if (filepaths.empty())
+    {
+        goalHandle.setRejected(pcd_watcher::new_pcdResult(), "No files");
+        return;
+    }
+
+    {
+        boost::mutex::scoped_lock lock(jobsMutex);
+        // A batch larger than the whole queue is still taken when the queue is empty
+        if (!jobs.empty() && jobs.size() + filepaths.size() > maxQueued)
+        {
+            ROS_WARN("Queue is full (%zu jobs), rejecting a batch of %zu", jobs.size(), filepaths.size());
+            goalHandle.setRejected(pcd_watcher::new_pcdResult(), "Queue full");
+            return;
+        }
+        goalHandle.setAccepted();
+
+        boost::shared_ptr<Batch> batch(new Batch);
+        batch->goalHandle = goalHandle;
+        batch->result.processedFilepaths.resize(filepaths.size());
+        batch->result.results.resize(filepaths.size());
+        batch->remaining = filepaths.size();
+        batch->processed = 0;
+        batch->canceled = false;
+        for (size_t i = 0; i < filepaths.size(); ++i)
+        {
+            Job job;
+            job.batch = batch;
+            job.index = i;
+            jobs.push_back(job);
+        }
+    }
+    jobsReady.notify_all();
+}
+
+void PcdWatcherServer::cancelCB(NewPcdServer::GoalHandle goalHandle)
+{
+    // Files that haven't started yet are dropped, the goal ends as canceled
+    // once the ones already running are done. finishBatch may run under
+    // jobsMutex here, actionlib's lock is already held so the order is the
+    // same as in goalCB.
+    boost::mutex::scoped_lock lock(jobsMutex);
+    std::deque<Job>::iterator it = jobs.begin();
+    while (it != jobs.end())
+    {
+        if (it->batch->goalHandle == goalHandle)
+        {
+            boost::shared_ptr<Batch> batch = it->batch;
+            batch->canceled = true;
+            batch->remaining--;
+            it = jobs.erase(it);
+            if (batch->remaining == 0)
+            {
+                finishBatch(*batch);
+            }
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+void PcdWatcherServer::workerLoop(int worker, int ompThreads)
+{
+#ifdef _OPENMP
+    omp_set_num_threads(ompThreads);
+#endif
+    Pipeline& pipeline = *pipelines[worker];
+
+    for (;;)
+    {
+        Job job;
+        std::string filepath;
+        {
+            boost::mutex::scoped_lock lock(jobsMutex);
+            while (jobs.empty() && !stopping)
+            {
+                jobsReady.wait(lock);
+            }
+            if (stopping)
+            {
+                return;
+            }
+            job = jobs.front();
+            jobs.pop_front();
+            filepath = job.batch->goalHandle.getGoal()->newFilepaths[job.index];
+            busyWorkers++;
+        }
+
+        std::string processedFilepath;
+        pcd_watcher::CloudResult cloudResult;
+        pcd_watcher::new_pcdFeedback feedback;
+        double start = monotonicMs();
+        bool ok = process(pipeline, filepath, processedFilepath, cloudResult, feedback.stages, feedback.cached);
+        double end = monotonicMs();
+        {
+            boost::mutex::scoped_lock lock(metricsMutex);
+            metrics.add(end, end - start, cloudResult.points_in, ok, feedback.cached, feedback.stages);
+        }
+
+        // Published before finishJob, feedback is ignored once the goal is done
+        feedback.filepath = filepath;
+        feedback.ok = ok;
+        job.batch->goalHandle.publishFeedback(feedback);
+        finishJob(*job.batch, job.index, ok, processedFilepath, cloudResult);
+    }
+}
+
+void PcdWatcherServer::finishJob(Batch& batch, size_t index, bool ok, const std::string& processedFilepath,
+                                 const pcd_watcher::CloudResult& cloudResult)
+{
+    bool last;
+    {
+        boost::mutex::scoped_lock lock(jobsMutex);
+        batch.result.results[index] = cloudResult;
+        if (ok)
+        {
+            batch.result.processedFilepaths[index] = processedFilepath;
+            batch.processed++;
+        }
+        else
+        {
+            batch.result.failedFilepaths.push_back(batch.goalHandle.getGoal()->newFilepaths[index]);
+        }
+        last = --batch.remaining == 0;
+        busyWorkers--;
+    }
+
+    // actionlib calls goalCB and cancelCB with its own lock held and they then
+    // take jobsMutex, while setSucceeded/setAborted take actionlib's lock. A
+    // worker taking them in the other order could deadlock, so the goal state
+    // is set after releasing jobsMutex. Nothing else touches a batch whose
+    // last job is done.
+    if (last)
+    {
+        finishBatch(batch);
+    }
+}
+
+void PcdWatcherServer::finishBatch(Batch& batch)
+{
+    if (batch.canceled)
+    {
+        batch.goalHandle.setCanceled(batch.result);
+    }
+    else if (batch.processed == 0)
+    {
+        batch.goalHandle.setAborted(batch.result, "No file could be processed");
+    }
+    else
+    {
+        ROS_INFO("Batch done, %zu processed, %zu failed", batch.processed, batch.result.failedFilepaths.size());
+        batch.goalHandle.setSucceeded(batch.result);
+    }
+}
+
+namespace
+{
+void addStage(std::vector<pcd_watcher::StageTiming>& stages, const std::string& name, double startMs,
+              size_t pointsIn, size_t pointsOut)
+{
+    pcd_watcher::StageTiming stage;
+    stage.name = name;
+    stage.milliseconds = monotonicMs() - startMs;
+    stage.points_in = pointsIn;
+    stage.points_out = pointsOut;
+    stages.push_back(stage);
+}
+}
+
+std::string PcdWatcherServer::outputName(const std::string& filepath) const
+{
+    // Files of the same name in different subdirectories must not share an
+    // output or a debug directory, so the subdirectories are kept. Files from
+    // elsewhere are named after their file name alone.
+    boost::filesystem::path name(filepath);
+    std::string prefix = directory == "/" ? directory : directory + "/";
+    if (filepath.compare(0, prefix.size(), prefix) == 0)
+    {
+        name = filepath.substr(prefix.size());
+    }
+    else
+    {
+        name = name.filename();
+    }
+    return (name.parent_path() / name.stem()).string();
+}
+
+bool PcdWatcherServer::process(Pipeline& pipeline, const std::string& filepath, std::string& processedFilepath,
+                               pcd_watcher::CloudResult& cloudResult, std::vector<pcd_watcher::StageTiming>& stages,
+                               bool& cached)
+{
+    cloudResult.filepath = filepath;
+    cloudResult.snapshot = -1;
+    if (!parseSnapshotName(filepath, cloudResult.object, cloudResult.angle, cloudResult.snapshot))
+    {
+        cloudResult.angle = 0.0;
+    }
+    cached = false;
+
+    // Same file and same stages give the same output, the hash covers both
+    std::string cacheKey;
+    double start = monotonicMs();
+    if (resultCache && resultCache->key(filepath, pipeline.describe(), cacheKey))
+    {
+        addStage(stages, "hash", start, 0, 0);
+        start = monotonicMs();
+        // The name write_processed gives the output
+        processedFilepath = outputName(filepath) + "_processed.pcd";
+        boost::filesystem::path parent = boost::filesystem::path(processedFilepath).parent_path();
+        boost::system::error_code ec;
+        if (!parent.empty())
+        {
+            boost::filesystem::create_directories(parent, ec);
+        }
+        if (resultCache->lookup(cacheKey, processedFilepath, cloudResult))
+        {
+            addStage(stages, "cache", start, cloudResult.points_in, cloudResult.points_out);
+            cached = true;
+            if (resultsLog)
+            {
+                resultsLog->append(cloudResult, processedFilepath, stages);
+            }
+            return true;
+        }
+    }
+
+    ModelProcessing &model_processing = pipeline.model_processing();
+    if (debugSink)
+    {
+        model_processing.set_debug_sink(debugSink, outputName(filepath));
+    }
+    start = monotonicMs();
+    pcl::PointCloud<pcl::PointXYZRGB>::Ptr new_cloud = model_processing.pcd_reader(filepath);
+    cloudResult.points_in = new_cloud->points.size();
+    addStage(stages, "read", start, 0, cloudResult.points_in);
+    if (new_cloud->points.empty())
+    {
+        ROS_WARN("Could not read any points from %s", filepath.c_str());
+        return false;
+    }
+
+    std::vector<StageTiming> timings;
+    new_cloud = pipeline.run(new_cloud, timings);
+    for (size_t i = 0; i < timings.size(); ++i)
+    {
+        pcd_watcher::StageTiming stage;
+        stage.name = timings[i].name;
+        stage.milliseconds = timings[i].milliseconds;
+        stage.points_in = timings[i].points_in;
+        stage.points_out = timings[i].points_out;
+        stages.push_back(stage);
+    }
+
+    // Bounding box and centroid come out of one pass over the cloud
+    start = monotonicMs();
+    CloudStats stats = model_processing.cloud_stats(new_cloud);
+    cloudResult.points_out = new_cloud->points.size();
+    for (int i = 0; i < 3; ++i)
+    {
+        cloudResult.centroid[i] = stats.centroid(i);
+        cloudResult.min[i] = stats.min(i);
+        cloudResult.max[i] = stats.max(i);
+    }
+    addStage(stages, "stats", start, cloudResult.points_out, cloudResult.points_out);
+
+    start = monotonicMs();
+    processedFilepath = model_processing.write_processed(new_cloud, outputName(filepath));
+    addStage(stages, "write", start, cloudResult.points_out, cloudResult.points_out);
+    if (!cacheKey.empty())
+    {
+        resultCache->store(cacheKey, processedFilepath, cloudResult);
+    }
+    if (resultsLog)
+    {
+        resultsLog->append(cloudResult, processedFilepath, stages);
+    }
+    return true;
+}
+
+void PcdWatcherServer::publishMetrics(const ros::TimerEvent& event)
+{
+    pcd_watcher::Metrics msg;
+    {
+        boost::mutex::scoped_lock lock(metricsMutex);
+        metrics.fill(msg);
+    }
+    {
+        boost::mutex::scoped_lock lock(jobsMutex);
+        msg.queue_depth = jobs.size();
+        msg.busy_workers = busyWorkers;
+    }
+    msg.stamp = ros::Time::now();
+    metricsPublisher.publish(msg);
 }
 
 int main(int argc, char **argv)
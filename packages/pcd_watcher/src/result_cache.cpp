@@ -0,0 +1,280 @@
+#include <pcd_watcher/result_cache.h>
+#include <ros/ros.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+const uint64_t PRIME1 = 11400714785074694791ULL;
+const uint64_t PRIME2 = 14029467366897019727ULL;
+const uint64_t PRIME3 = 1609587929392839161ULL;
+const uint64_t PRIME4 = 9650029242287828579ULL;
+const uint64_t PRIME5 = 2870177450012600261ULL;
+
+inline uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t read64(const unsigned char* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t read32(const unsigned char* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t xxRound(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME2;
+    acc = rotl(acc, 31);
+    return acc * PRIME1;
+}
+
+inline uint64_t mergeRound(uint64_t acc, uint64_t val)
+{
+    acc ^= xxRound(0, val);
+    return acc * PRIME1 + PRIME4;
+}
+
+// Always a copy: the output is rewritten in place by pcd_writer, a hard link
+// would let that change the cache entry too
+bool copyFile(const std::string& from, const std::string& to)
+{
+    int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0)
+    {
+        return false;
+    }
+    int out = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0)
+    {
+        close(in);
+        return false;
+    }
+
+    std::vector<char> buffer(1 << 20);
+    bool ok = true;
+    ssize_t n;
+    while (ok && (n = read(in, &buffer[0], buffer.size())) > 0)
+    {
+        ok = write(out, &buffer[0], n) == n;
+    }
+    ok = ok && n == 0;
+    close(in);
+    return close(out) == 0 && ok;
+}
+}
+
+StreamHash::StreamHash(uint64_t seed) :
+        seed(seed),
+        pendingSize(0),
+        totalSize(0)
+{
+    acc[0] = seed + PRIME1 + PRIME2;
+    acc[1] = seed + PRIME2;
+    acc[2] = seed;
+    acc[3] = seed - PRIME1;
+}
+
+void StreamHash::consume(const unsigned char* stripe)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        acc[i] = xxRound(acc[i], read64(stripe + 8 * i));
+    }
+}
+
+void StreamHash::update(const void* data, size_t size)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + size;
+    totalSize += size;
+
+    if (pendingSize > 0)
+    {
+        size_t fill = std::min(size, sizeof(pending) - pendingSize);
+        memcpy(pending + pendingSize, p, fill);
+        pendingSize += fill;
+        p += fill;
+        if (pendingSize < sizeof(pending))
+        {
+            return;
+        }
+        consume(pending);
+        pendingSize = 0;
+    }
+    for (; p + 32 <= end; p += 32)
+    {
+        consume(p);
+    }
+    memcpy(pending, p, end - p);
+    pendingSize = end - p;
+}
+
+uint64_t StreamHash::digest() const
+{
+    uint64_t h;
+    if (totalSize >= 32)
+    {
+        h = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+        for (int i = 0; i < 4; ++i)
+        {
+            h = mergeRound(h, acc[i]);
+        }
+    }
+    else
+    {
+        h = seed + PRIME5;
+    }
+    h += totalSize;
+
+    const unsigned char* p = pending;
+    const unsigned char* end = pending + pendingSize;
+    for (; p + 8 <= end; p += 8)
+    {
+        h ^= xxRound(0, read64(p));
+        h = rotl(h, 27) * PRIME1 + PRIME4;
+    }
+    if (p + 4 <= end)
+    {
+        h ^= static_cast<uint64_t>(read32(p)) * PRIME1;
+        h = rotl(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+    {
+        h ^= *p * PRIME5;
+        h = rotl(h, 11) * PRIME1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+ResultCache::ResultCache(const std::string& directory) :
+        directory(directory),
+        opened(true)
+{
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        ROS_WARN("Could not create result cache %s: %s", directory.c_str(), strerror(errno));
+        opened = false;
+    }
+}
+
+bool ResultCache::isOpen() const
+{
+    return opened;
+}
+
+bool ResultCache::key(const std::string& filepath, const std::string& pipelineDescription, std::string& key) const
+{
+    int fd = ::open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // The pipeline description seeds the hash, changing a parameter changes every key
+    StreamHash pipelineHash;
+    pipelineHash.update(pipelineDescription.data(), pipelineDescription.size());
+    StreamHash hash(pipelineHash.digest());
+
+    std::vector<char> buffer(1 << 20);
+    ssize_t n;
+    while ((n = read(fd, &buffer[0], buffer.size())) > 0)
+    {
+        hash.update(&buffer[0], n);
+    }
+    close(fd);
+    if (n < 0)
+    {
+        return false;
+    }
+
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash.digest()));
+    key = hex;
+    return true;
+}
+
+bool ResultCache::lookup(const std::string& key, const std::string& processedFilepath,
+                         pcd_watcher::CloudResult& result) const
+{
+    std::string base = directory + "/" + key;
+    FILE* stats = fopen((base + ".stats").c_str(), "r");
+    if (stats == NULL)
+    {
+        return false;
+    }
+    unsigned int pointsIn, pointsOut;
+    float v[9];
+    int fields = fscanf(stats, "%u %u %g %g %g %g %g %g %g %g %g", &pointsIn, &pointsOut, &v[0], &v[1], &v[2],
+                        &v[3], &v[4], &v[5], &v[6], &v[7], &v[8]);
+    fclose(stats);
+    if (fields != 11 || !copyFile(base + ".pcd", processedFilepath))
+    {
+        return false;
+    }
+
+    result.points_in = pointsIn;
+    result.points_out = pointsOut;
+    for (int i = 0; i < 3; ++i)
+    {
+        result.centroid[i] = v[i];
+        result.min[i] = v[3 + i];
+        result.max[i] = v[6 + i];
+    }
+    return true;
+}
+
+void ResultCache::store(const std::string& key, const std::string& processedFilepath,
+                        const pcd_watcher::CloudResult& result) const
+{
+    // The cloud goes in first, an entry only counts once its stats exist
+    std::string base = directory + "/" + key;
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%d.%lx.tmp", static_cast<int>(getpid()),
+             static_cast<unsigned long>(pthread_self()));
+    std::string tmpCloud = base + ".pcd" + suffix;
+    std::string tmpStats = base + ".stats" + suffix;
+
+    if (!copyFile(processedFilepath, tmpCloud) || rename(tmpCloud.c_str(), (base + ".pcd").c_str()) != 0)
+    {
+        ROS_WARN("Could not cache %s: %s", processedFilepath.c_str(), strerror(errno));
+        unlink(tmpCloud.c_str());
+        return;
+    }
+
+    FILE* stats = fopen(tmpStats.c_str(), "w");
+    if (stats == NULL)
+    {
+        return;
+    }
+    fprintf(stats, "%u %u %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n", result.points_in, result.points_out,
+            result.centroid[0], result.centroid[1], result.centroid[2], result.min[0], result.min[1],
+            result.min[2], result.max[0], result.max[1], result.max[2]);
+    if (fclose(stats) != 0 || rename(tmpStats.c_str(), (base + ".stats").c_str()) != 0)
+    {
+        unlink(tmpStats.c_str());
+    }
+}
@@ -0,0 +1,214 @@
+#include <pcd_watcher/results_log.h>
+#include <ros/ros.h>
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#include <boost/bind.hpp>
+
+namespace
+{
+void appendJsonString(std::ostringstream& out, const std::string& value)
+{
+    out << '"';
+    for (size_t i = 0; i < value.size(); ++i)
+    {
+        unsigned char c = value[i];
+        if (c == '"' || c == '\\')
+        {
+            out << '\\' << c;
+        }
+        else if (c < 0x20)
+        {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out << escaped;
+        }
+        else
+        {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+// JSON has no NaN, the stats of an empty cloud are written as null
+void appendJsonNumber(std::ostringstream& out, double value)
+{
+    if (isfinite(value))
+    {
+        out << value;
+    }
+    else
+    {
+        out << "null";
+    }
+}
+
+void appendJsonVector(std::ostringstream& out, const boost::array<float, 3>& value)
+{
+    out << '[';
+    for (size_t i = 0; i < 3; ++i)
+    {
+        if (i > 0)
+        {
+            out << ',';
+        }
+        appendJsonNumber(out, value[i]);
+    }
+    out << ']';
+}
+}
+
+bool parseSnapshotName(const std::string& filepath, std::string& object, double& angle, int& snapshot)
+{
+    std::string::size_type slash = filepath.rfind('/');
+    std::string name = filepath.substr(slash == std::string::npos ? 0 : slash + 1);
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".pcd") == 0)
+    {
+        name.erase(name.size() - 4);
+    }
+
+    std::string::size_type dash = name.rfind('-');
+    if (dash == std::string::npos || dash + 1 == name.size()
+        || name.find_first_not_of("0123456789", dash + 1) != std::string::npos)
+    {
+        return false;
+    }
+    std::string::size_type angleBegin = name.find_last_not_of("0123456789.", dash - 1);
+    angleBegin = angleBegin == std::string::npos ? 0 : angleBegin + 1;
+    if (angleBegin == 0 || angleBegin == dash)
+    {
+        return false;
+    }
+
+    std::string angleText = name.substr(angleBegin, dash - angleBegin);
+    char* end;
+    double value = strtod(angleText.c_str(), &end);
+    if (*end != '\0')
+    {
+        return false;
+    }
+
+    object = name.substr(0, angleBegin);
+    angle = value;
+    snapshot = atoi(name.c_str() + dash + 1);
+    return true;
+}
+
+ResultsLog::ResultsLog(const std::string& path, double flushInterval) :
+        file(fopen(path.c_str(), "a")),
+        flushInterval(flushInterval),
+        stopping(false)
+{
+    if (file == NULL)
+    {
+        ROS_WARN("Could not open results log %s: %s", path.c_str(), strerror(errno));
+        return;
+    }
+    flusher = boost::thread(boost::bind(&ResultsLog::flushLoop, this));
+}
+
+ResultsLog::~ResultsLog()
+{
+    if (file == NULL)
+    {
+        return;
+    }
+    {
+        boost::mutex::scoped_lock lock(bufferMutex);
+        stopping = true;
+    }
+    bufferReady.notify_all();
+    flusher.join();
+    fclose(file);
+}
+
+bool ResultsLog::isOpen() const
+{
+    return file != NULL;
+}
+
+void ResultsLog::append(const pcd_watcher::CloudResult& result, const std::string& outputFilepath,
+                        const std::vector<pcd_watcher::StageTiming>& timings)
+{
+    if (file == NULL)
+    {
+        return;
+    }
+
+    char time[32];
+    snprintf(time, sizeof(time), "%.3f", ros::WallTime::now().toSec());
+
+    std::ostringstream out;
+    out.precision(7);
+    out << "{\"time\":" << time << ",\"file\":";
+    appendJsonString(out, result.filepath);
+    out << ",\"object\":";
+    appendJsonString(out, result.object);
+    out << ",\"angle\":";
+    appendJsonNumber(out, result.angle);
+    out << ",\"snapshot\":" << result.snapshot << ",\"output\":";
+    appendJsonString(out, outputFilepath);
+    out << ",\"points_in\":" << result.points_in << ",\"points_out\":" << result.points_out << ",\"centroid\":";
+    appendJsonVector(out, result.centroid);
+    out << ",\"min\":";
+    appendJsonVector(out, result.min);
+    out << ",\"max\":";
+    appendJsonVector(out, result.max);
+    out << ",\"stages\":[";
+    for (size_t i = 0; i < timings.size(); ++i)
+    {
+        out << (i > 0 ? ",{\"name\":" : "{\"name\":");
+        appendJsonString(out, timings[i].name);
+        out << ",\"ms\":";
+        appendJsonNumber(out, timings[i].milliseconds);
+        out << '}';
+    }
+    out << "]}\n";
+
+    boost::mutex::scoped_lock lock(bufferMutex);
+    buffer.push_back(out.str());
+}
+
+void ResultsLog::flushLoop()
+{
+    std::vector<std::string> lines;
+    boost::mutex::scoped_lock lock(bufferMutex);
+    for (;;)
+    {
+        if (!stopping)
+        {
+            bufferReady.timed_wait(lock, boost::posix_time::milliseconds(static_cast<long>(flushInterval * 1000.0)));
+        }
+        lines.swap(buffer);
+        bool last = stopping;
+
+        lock.unlock();
+        writeOut(lines);
+        lock.lock();
+
+        if (last)
+        {
+            return;
+        }
+    }
+}
+
+void ResultsLog::writeOut(std::vector<std::string>& lines)
+{
+    if (lines.empty())
+    {
+        return;
+    }
+    for (size_t i = 0; i < lines.size(); ++i)
+    {
+        fwrite(lines[i].data(), 1, lines[i].size(), file);
+    }
+    if (fflush(file) != 0)
+    {
+        ROS_WARN("Could not write %zu results: %s", lines.size(), strerror(errno));
+    }
+    lines.clear();
+}